@@ -0,0 +1,378 @@
+/********************** 说明 ***************************
+ * i2c-dev各种访问方式的吞吐/延迟测试工具，可以在真实总线、
+ * 内核i2c-stub模块（modprobe i2c-stub chip_addr=0x1d）或
+ * i2c_sim模拟器（LD_PRELOAD=libi2c_sim.so）上运行。
+ *
+ * 一个“事务”是从从设备reg 0开始读回size字节，访问方式有：
+ * rw:          write()寄存器地址 + read()数据，即i2c_dev_read_write.c的方式
+ * rdwr:        每个寄存器一次I2C_RDWR，即i2c_dev_ioctl.c的方式
+ * rdwr_batch:  多个寄存器的消息对打包进一次I2C_RDWR
+ * rdwr_burst:  一次I2C_RDWR完成“写地址+读size字节”
+ * smbus_block: I2C_SMBUS_I2C_BLOCK_DATA，每次最多32字节
+ * 适配器不支持的方式（通过I2C_FUNCS判断）会被跳过。
+ *
+ * 对每种方式、每个size、每个并发客户端数（每个客户端一个线程、
+ * 一个独立的fd）跑若干次事务，以CSV格式输出：
+ * style,size,clients,transactions,tps,bytes_per_s,p50_us,p99_us,p999_us,syscalls_per_byte
+******************************************************/
+
+#include <stdio.h>
+#include <linux/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS	42
+#endif
+
+#define MSGS_PER_IOCTL		(I2C_RDWR_IOCTL_MAX_MSGS & ~1)
+#define XFER_SIZE_MAX		256
+#define MAX_CLIENTS		64
+#define ITERATIONS_DEFAULT	1000
+
+struct bench_ctx;
+
+struct bench_style {
+	const char *name;
+	unsigned long funcs;	/* 需要适配器支持的功能 */
+	int (*xfer)(struct bench_ctx *ctx, int fd);
+};
+
+struct bench_ctx {
+	const char *dev;
+	unsigned int slave_address;
+	unsigned int size;
+	unsigned int iterations;
+	const struct bench_style *style;
+};
+
+struct bench_client {
+	struct bench_ctx *ctx;
+	pthread_t thread;
+	long *lat_ns;
+	unsigned long syscalls;
+	unsigned long errors;
+};
+
+static __thread unsigned long nr_syscalls;
+
+static int i2c_rdwr(int fd, struct i2c_msg *msgs, unsigned int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data work_queue;
+
+	work_queue.msgs = msgs;
+	work_queue.nmsgs = nmsgs;
+	nr_syscalls++;
+
+	return ioctl(fd, I2C_RDWR, (unsigned long)&work_queue);
+}
+
+static void fill_msg_pair(struct i2c_msg *msgs, unsigned int slave_address,
+			  unsigned char *reg, unsigned char *val, unsigned short len)
+{
+	msgs[0].addr = slave_address;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = reg;
+
+	msgs[1].addr = slave_address;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = len;
+	msgs[1].buf = val;
+}
+
+static int xfer_rw(struct bench_ctx *ctx, int fd)
+{
+	unsigned char reg = 0;
+	unsigned char vals[XFER_SIZE_MAX];
+
+	nr_syscalls += 2;
+	if (write(fd, &reg, 1) != 1)
+		return -1;
+	if (read(fd, vals, ctx->size) != (ssize_t)ctx->size)
+		return -1;
+
+	return 0;
+}
+
+static int xfer_rdwr(struct bench_ctx *ctx, int fd)
+{
+	struct i2c_msg msgs[2];
+	unsigned char regs[XFER_SIZE_MAX];
+	unsigned char vals[XFER_SIZE_MAX];
+	unsigned int i;
+
+	for (i = 0; i < ctx->size; i++) {
+		regs[i] = i;
+		fill_msg_pair(msgs, ctx->slave_address, &regs[i], &vals[i], 1);
+		if (i2c_rdwr(fd, msgs, 2) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int xfer_rdwr_batch(struct bench_ctx *ctx, int fd)
+{
+	struct i2c_msg msgs[XFER_SIZE_MAX * 2];
+	unsigned char regs[XFER_SIZE_MAX];
+	unsigned char vals[XFER_SIZE_MAX];
+	unsigned int nmsgs = ctx->size * 2;
+	unsigned int i, n;
+
+	for (i = 0; i < ctx->size; i++) {
+		regs[i] = i;
+		fill_msg_pair(&msgs[i * 2], ctx->slave_address, &regs[i], &vals[i], 1);
+	}
+	for (i = 0; i < nmsgs; i += n) {
+		n = nmsgs - i > MSGS_PER_IOCTL ? MSGS_PER_IOCTL : nmsgs - i;
+		if (i2c_rdwr(fd, &msgs[i], n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int xfer_rdwr_burst(struct bench_ctx *ctx, int fd)
+{
+	struct i2c_msg msgs[2];
+	unsigned char reg = 0;
+	unsigned char vals[XFER_SIZE_MAX];
+
+	fill_msg_pair(msgs, ctx->slave_address, &reg, vals, ctx->size);
+
+	return i2c_rdwr(fd, msgs, 2) < 0 ? -1 : 0;
+}
+
+static int xfer_smbus_block(struct bench_ctx *ctx, int fd)
+{
+	struct i2c_smbus_ioctl_data args;
+	union i2c_smbus_data data;
+	unsigned int done, len;
+
+	for (done = 0; done < ctx->size; done += len) {
+		len = ctx->size - done;
+		if (len > I2C_SMBUS_BLOCK_MAX)
+			len = I2C_SMBUS_BLOCK_MAX;
+		data.block[0] = len;
+		args.read_write = I2C_SMBUS_READ;
+		args.command = done;
+		args.size = I2C_SMBUS_I2C_BLOCK_DATA;
+		args.data = &data;
+		nr_syscalls++;
+		if (ioctl(fd, I2C_SMBUS, &args) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static const struct bench_style bench_styles[] = {
+	{ "rw",		I2C_FUNC_I2C,			xfer_rw },
+	{ "rdwr",	I2C_FUNC_I2C,			xfer_rdwr },
+	{ "rdwr_batch",	I2C_FUNC_I2C,			xfer_rdwr_batch },
+	{ "rdwr_burst",	I2C_FUNC_I2C,			xfer_rdwr_burst },
+	{ "smbus_block", I2C_FUNC_SMBUS_READ_I2C_BLOCK,	xfer_smbus_block },
+};
+
+static long timespec_ns(const struct timespec *t0, const struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1000000000L + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static void *bench_client_run(void *arg)
+{
+	struct bench_client *client = arg;
+	struct bench_ctx *ctx = client->ctx;
+	struct timespec t0, t1;
+	unsigned int i;
+	int fd;
+
+	fd = open(ctx->dev, O_RDWR);
+	if (fd < 0) {
+		client->errors = ctx->iterations;
+		return NULL;
+	}
+	ioctl(fd, I2C_SLAVE_FORCE, ctx->slave_address);
+
+	nr_syscalls = 0;
+	for (i = 0; i < ctx->iterations; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (ctx->style->xfer(ctx, fd) < 0)
+			client->errors++;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		client->lat_ns[i] = timespec_ns(&t0, &t1);
+	}
+	client->syscalls = nr_syscalls;
+
+	close(fd);
+	return NULL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const long *sorted, unsigned long n, double p)
+{
+	unsigned long idx = (unsigned long)(p * (n - 1) + 0.5);
+
+	return sorted[idx] / 1000.0;
+}
+
+static int bench_run(struct bench_ctx *ctx, unsigned int nclients)
+{
+	struct bench_client clients[MAX_CLIENTS];
+	struct timespec t0, t1;
+	unsigned long total = (unsigned long)ctx->iterations * nclients;
+	unsigned long syscalls = 0, errors = 0;
+	long *lat;
+	double secs;
+	unsigned int i;
+
+	lat = malloc(total * sizeof(*lat));
+	if (!lat)
+		return -1;
+
+	memset(clients, 0, sizeof(clients));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nclients; i++) {
+		clients[i].ctx = ctx;
+		clients[i].lat_ns = &lat[(unsigned long)i * ctx->iterations];
+		pthread_create(&clients[i].thread, NULL, bench_client_run, &clients[i]);
+	}
+	for (i = 0; i < nclients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		syscalls += clients[i].syscalls;
+		errors += clients[i].errors;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (errors) {
+		fprintf(stderr, "%s size:%u clients:%u: %lu failed transactions\n",
+			ctx->style->name, ctx->size, nclients, errors);
+	}
+
+	qsort(lat, total, sizeof(*lat), cmp_long);
+	secs = timespec_ns(&t0, &t1) / 1e9;
+	printf("%s,%u,%u,%lu,%.1f,%.1f,%.2f,%.2f,%.2f,%.4f\n",
+	       ctx->style->name, ctx->size, nclients, total,
+	       total / secs, total * ctx->size / secs,
+	       percentile_us(lat, total, 0.50),
+	       percentile_us(lat, total, 0.99),
+	       percentile_us(lat, total, 0.999),
+	       (double)syscalls / (total * ctx->size));
+
+	free(lat);
+	return 0;
+}
+
+/* 判断name是否在逗号分隔的列表中 */
+static int in_list(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = list;
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+
+	return 0;
+}
+
+/* 解析逗号分隔的数字列表 */
+static unsigned int parse_list(const char *s, unsigned int *vals, unsigned int max)
+{
+	unsigned int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		vals[n++] = strtoul(s, &end, 0);
+		if (end == s)
+			break;
+		s = *end == ',' ? end + 1 : end;
+	}
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx;
+	unsigned int sizes[16] = { 1, 4, 16, 32, 64, 256 };
+	unsigned int nsizes = 6;
+	unsigned int clients[16] = { 1, 2, 4, 8 };
+	unsigned int nclients = 4;
+	const char *styles = NULL;
+	unsigned long funcs = 0;
+	unsigned int i, j, k;
+	int fd;
+
+	if (argc < 3) {
+		printf("Use:\n%s /dev/i2c-x slave_addr [iterations] [styles] [sizes] [clients]\n"
+		       "styles: rw,rdwr,rdwr_batch,rdwr_burst,smbus_block (default all)\n"
+		       "sizes/clients: comma separated lists\n", argv[0]);
+		return 0;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.dev = argv[1];
+	sscanf(argv[2], "%x", &ctx.slave_address);
+	ctx.iterations = ITERATIONS_DEFAULT;
+	if (argc > 3)
+		sscanf(argv[3], "%u", &ctx.iterations);
+	if (argc > 4)
+		styles = argv[4];
+	if (argc > 5)
+		nsizes = parse_list(argv[5], sizes, 16);
+	if (argc > 6)
+		nclients = parse_list(argv[6], clients, 16);
+	if (!ctx.iterations)
+		ctx.iterations = ITERATIONS_DEFAULT;
+
+	fd = open(ctx.dev, O_RDWR);
+	if (fd < 0) {
+		printf("Error on opening the device file\n");
+		return 0;
+	}
+	ioctl(fd, I2C_FUNCS, &funcs);
+	close(fd);
+
+	printf("style,size,clients,transactions,tps,bytes_per_s,p50_us,p99_us,p999_us,syscalls_per_byte\n");
+	for (i = 0; i < sizeof(bench_styles) / sizeof(bench_styles[0]); i++) {
+		ctx.style = &bench_styles[i];
+		if (styles && *styles && !in_list(styles, ctx.style->name))
+			continue;
+		if ((funcs & ctx.style->funcs) != ctx.style->funcs) {
+			fprintf(stderr, "%s: not supported by adapter, skipped\n",
+				ctx.style->name);
+			continue;
+		}
+		for (j = 0; j < nsizes; j++) {
+			ctx.size = sizes[j];
+			if (!ctx.size || ctx.size > XFER_SIZE_MAX)
+				continue;
+			for (k = 0; k < nclients; k++) {
+				if (!clients[k] || clients[k] > MAX_CLIENTS)
+					continue;
+				bench_run(&ctx, clients[k]);
+			}
+		}
+	}
+
+	return 0;
+}
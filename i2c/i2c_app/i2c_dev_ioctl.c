@@ -4,8 +4,19 @@
  * 外设。i2c_dev.c针对每个i2c适配器生成一个主设备号为89的设备文
  * 件，实现了i2c_driver的成员函数及文件操作接口，因此i2c_dev.c
  * 的主体是“i2c_driver成员函数+字符设备驱动”。
- * 
+ *
  * 以下代码就是利用O_RDWR IOCTL读写i2c设备
+ *
+ * 支持三种寄存器dump方式：
+ * single: 每个寄存器一次I2C_RDWR（写寄存器地址+读1字节），最慢
+ * batch:  把多个寄存器的“写+读”消息对打包进同一个i2c_rdwr_ioctl_data，
+ *         每次ioctl最多携带I2C_RDWR_IOCTL_MAX_MSGS条消息
+ * burst:  利用从设备寄存器地址自动递增，一次“写+读”读回整个区间
+ * 每种方式结束后打印ioctl次数和耗时，便于比较
+ *
+ * 消息序列由i2c_regmap.h生成：要dump的区间就是一张每个寄存器1字节的
+ * 寄存器表，三种方式只是生成参数不同（是否合并连续寄存器、每次ioctl
+ * 带多少条消息）
 ******************************************************/
 
 #include <stdio.h>
@@ -18,61 +29,125 @@
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
+#include "i2c_regmap.h"
+
+#define REG_NUM_DEFAULT		16
+#define REG_SPACE_SIZE		256 /* 8位寄存器地址空间 */
+/* 每次ioctl可携带的消息数，“写+读”成对出现，所以取偶数 */
+#define MSGS_PER_IOCTL		(I2C_RDWR_IOCTL_MAX_MSGS & ~1)
+
+enum dump_mode {
+	DUMP_SINGLE,
+	DUMP_BATCH,
+	DUMP_BURST,
+};
+
+static const char * const dump_mode_name[] = {
+	[DUMP_SINGLE]	= "single",
+	[DUMP_BATCH]	= "batch",
+	[DUMP_BURST]	= "burst",
+};
+
+static struct regmap_reg regs[REG_SPACE_SIZE];
+static struct regmap_plan plan;
+
+/* [reg_address, reg_address + count)的寄存器表，第i个寄存器解码到vals[i] */
+static void build_range_map(struct regmap_map *map, unsigned int reg_address,
+			    unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		regs[i].addr = reg_address + i;
+		regs[i].width = 1;
+		regs[i].offset = i;
+	}
+	map->name = "range";
+	map->regs = regs;
+	map->nr = count;
+	map->autoinc = 0;
+}
 
 int main(int argc, char **argv)
 {
-	struct i2c_rdwr_ioctl_data work_queue;
-	unsigned int idx;
-	unsigned int fd;
+	struct regmap_map map;
+	struct timespec t0, t1;
 	unsigned int slave_address, reg_address;
-	unsigned char val;
-	int i;
+	unsigned int count = REG_NUM_DEFAULT;
+	unsigned char vals[REG_SPACE_SIZE];
+	enum dump_mode mode = DUMP_SINGLE;
+	long usecs;
+	unsigned int i;
+	int fd;
 	int ret;
 
 	if (argc < 4) {
-		printf("Use:\n%s /dev/i2c-x start_addr reg_addr\n", argv[0]);
+		printf("Use:\n%s /dev/i2c-x start_addr reg_addr [count] [single|batch|burst]\n",
+		       argv[0]);
 		return 0;
 	}
 
 	fd = open(argv[1], O_RDWR);
 
-	if (!fd) {
+	if (fd < 0) {
 		printf("Error on opening the device file\n");
 		return 0;
 	}
 	sscanf(argv[2], "%x", &slave_address);
 	sscanf(argv[3], "%x", &reg_address);
+	if (argc > 4)
+		sscanf(argv[4], "%u", &count);
+	if (argc > 5) {
+		for (i = 0; i < sizeof(dump_mode_name) / sizeof(dump_mode_name[0]); i++)
+			if (!strcmp(argv[5], dump_mode_name[i]))
+				break;
+		if (i == sizeof(dump_mode_name) / sizeof(dump_mode_name[0])) {
+			printf("Unknown dump mode: %s\n", argv[5]);
+			close(fd);
+			return 0;
+		}
+		mode = i;
+	}
 
-	work_queue.nmsgs = 2; /* 设置超时 */
-	work_queue.msgs = (struct i2c_msg *)malloc(work_queue.nmsgs *sizeof(struct i2c_msg));
-	if (!work_queue.msgs) {
-		printf("Memory alloc error\n");
-		close(fd);
-		return 0;
+	reg_address &= REG_SPACE_SIZE - 1;
+	if (count == 0 || count > REG_SPACE_SIZE - reg_address)
+		count = REG_SPACE_SIZE - reg_address;
+
+	/* single: 每次ioctl一对消息；batch: 不合并，但每次ioctl带满消息；
+	 * burst: 连续寄存器合并成一次突发读 */
+	build_range_map(&map, reg_address, count);
+	switch (mode) {
+	case DUMP_BATCH:
+		regmap_plan_build(&plan, &map, slave_address, REGMAP_NO_MERGE, MSGS_PER_IOCTL);
+		break;
+	case DUMP_BURST:
+		regmap_plan_build(&plan, &map, slave_address, 0, MSGS_PER_IOCTL);
+		break;
+	default:
+		regmap_plan_build(&plan, &map, slave_address, REGMAP_NO_MERGE, 2);
+		break;
 	}
+	memset(vals, 0, sizeof(vals));
 
 	ioctl(fd, I2C_TIMEOUT, 2); /* 设置超时 */
 	ioctl(fd, I2C_RETRIES, 1); /* 设置重试次数 */
 
-	for (i = reg_address; i < reg_address + 16; i++) {
-		val = i;
-		(work_queue.msgs[0]).len = 1;
-		(work_queue.msgs[0]).addr = slave_address;
-		(work_queue.msgs[0]).buf = &val;
-
-		(work_queue.msgs[1]).len = 1;
-		(work_queue.msgs[1]).flags = I2C_M_RD;
-		(work_queue.msgs[1]).addr = slave_address;
-		(work_queue.msgs[1]).buf = &val;
-
-		ret = ioctl(fd, I2C_RDWR, (unsigned long)&work_queue);
-		if (ret < 0)
-			printf("Error during I2C_RDWR ioctl with error code: %d\n", ret);
-		printf("reg:%02x val:%02x\n", i, val);
-	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = regmap_read(fd, &plan, vals);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (ret < 0)
+		printf("Error during I2C_RDWR ioctl with error code: %d\n", ret);
+
+	for (i = 0; i < count; i++)
+		printf("reg:%02x val:%02x\n", regs[i].addr, vals[i]);
+
+	usecs = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+	printf("mode:%s regs:%u ioctls:%lu time:%ldus%s\n", dump_mode_name[mode],
+	       count, plan.nr_ioctls, usecs, ret < 0 ? " (with errors)" : "");
 
 	close(fd);
 	return 0;
-}
\ No newline at end of file
+}
@@ -4,8 +4,17 @@
  * 外设。i2c_dev.c针对每个i2c适配器生成一个主设备号为89的设备文
  * 件，实现了i2c_driver的成员函数及文件操作接口，因此i2c_dev.c
  * 的主体是“i2c_driver成员函数+字符设备驱动”。
- * 
+ *
  * 以下代码就是利用该文件中实现的read()和write()读写i2c设备
+ *
+ * 读：只写一次2字节的存储地址，之后利用EEPROM内部地址自动递增，
+ *     连续read()大块数据（i2c-dev每次read()最多8192字节），
+ *     输出到标准输出或文件，大小不受限制
+ * 写：按页对齐，每页一次write()（2字节地址+页数据），写完后通过
+ *     ACK轮询等待内部写周期结束，而不是固定睡眠最长写周期；
+ *     全部写完后可流式读回校验
+ * 存储地址只有2字节，超出64KB的范围会回绕到芯片开头，直接拒绝；
+ * 失败时返回非0，便于脚本判断烧写是否成功
 ******************************************************/
 
 #include <stdio.h>
@@ -13,58 +22,252 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
-#define BUFF_SIZE	32
+#define EEPROM_ADDR		0x50
+#define CHUNK_SIZE		8192	/* i2c-dev中read()/write()单次最大长度 */
+#define PAGE_SIZE_DEFAULT	64	/* 24C256/24C512的页大小 */
+#define PAGE_SIZE_MAX		256
+#define EEPROM_SIZE_MAX		65536	/* 2字节存储地址能寻址的范围 */
+#define ACK_POLL_TIMEOUT_US	20000	/* 比数据手册最长写周期(5~10ms)留足余量 */
+
+static unsigned long nr_syscalls;
+
+static long elapsed_us(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000000L +
+		(t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+/* 设置EEPROM内部地址指针，高字节在前 */
+static int eeprom_set_addr(int fd, unsigned short mem_addr)
+{
+	unsigned char addr[2];
+
+	addr[0] = mem_addr >> 8;
+	addr[1] = mem_addr & 0xff;
+	nr_syscalls++;
+
+	return write(fd, addr, 2) == 2 ? 0 : -1;
+}
+
+/* 写周期内EEPROM不应答，轮询直到它重新ACK自己的地址 */
+static int eeprom_ack_poll(int fd, unsigned short mem_addr)
+{
+	struct timespec t0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (eeprom_set_addr(fd, mem_addr) < 0) {
+		if (elapsed_us(&t0) > ACK_POLL_TIMEOUT_US)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int eeprom_stream_read(int fd, unsigned short mem_addr,
+			      unsigned long size, FILE *out)
+{
+	unsigned char buf[CHUNK_SIZE];
+	unsigned long done;
+	ssize_t n, len;
+
+	if (eeprom_set_addr(fd, mem_addr) < 0) {
+		fprintf(stderr, "Error setting EEPROM address\n");
+		return -1;
+	}
+
+	for (done = 0; done < size; done += n) {
+		len = size - done > CHUNK_SIZE ? CHUNK_SIZE : size - done;
+		nr_syscalls++;
+		n = read(fd, buf, len);
+		if (n <= 0) {
+			fprintf(stderr, "Error reading EEPROM at %lu\n", done);
+			return -1;
+		}
+		if (fwrite(buf, 1, n, out) != (size_t)n) {
+			fprintf(stderr, "Error writing output\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int eeprom_verify(int fd, unsigned short mem_addr,
+			 const unsigned char *data, unsigned long size)
+{
+	unsigned char buf[CHUNK_SIZE];
+	unsigned long done;
+	ssize_t n, len;
+
+	if (eeprom_set_addr(fd, mem_addr) < 0)
+		return -1;
+
+	for (done = 0; done < size; done += n) {
+		len = size - done > CHUNK_SIZE ? CHUNK_SIZE : size - done;
+		nr_syscalls++;
+		n = read(fd, buf, len);
+		if (n <= 0)
+			return -1;
+		if (memcmp(buf, data + done, n)) {
+			fprintf(stderr, "Verify failed near offset %lu\n", done);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int eeprom_page_write(int fd, unsigned short mem_addr,
+			     const unsigned char *data, unsigned long size,
+			     unsigned int page_size)
+{
+	unsigned char buf[PAGE_SIZE_MAX + 2];
+	unsigned long done;
+	unsigned int len;
+
+	for (done = 0; done < size; done += len, mem_addr += len) {
+		/* 不能跨页，否则EEPROM会在页内回绕覆盖 */
+		len = page_size - (mem_addr % page_size);
+		if (len > size - done)
+			len = size - done;
+
+		buf[0] = mem_addr >> 8;
+		buf[1] = mem_addr & 0xff;
+		memcpy(&buf[2], data + done, len);
+		nr_syscalls++;
+		if (write(fd, buf, len + 2) != (ssize_t)(len + 2)) {
+			fprintf(stderr, "Error writing page at 0x%04x\n", mem_addr);
+			return -1;
+		}
+		if (eeprom_ack_poll(fd, mem_addr) < 0) {
+			fprintf(stderr, "EEPROM busy timeout at 0x%04x\n", mem_addr);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned char *load_file(const char *path, unsigned long *size)
+{
+	unsigned char *data;
+	FILE *fp;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(len > 0 ? len : 1);
+	if (data && fread(data, 1, len, fp) != (size_t)len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(fp);
+	*size = len;
+
+	return data;
+}
 
 int main(int argc, char **argv)
 {
-	unsigned int fd;
-	unsigned short mem_addr;
-	unsigned short size;
-	unsigned short idx;
-	char buf[BUFF_SIZE];
-	char cswap;
-
-	union {
-		unsigned short addr;
-		char bytes[2];
-	} tmp;
-
-	if (argc < 3) {
-		printf("Use:\n%s /dev/i2c-x mem_addr size\n", argv[0]);
+	struct timespec t0;
+	unsigned int mem_addr;
+	unsigned long size;
+	unsigned int page_size = PAGE_SIZE_DEFAULT;
+	unsigned char *data;
+	FILE *out = stdout;
+	int fd;
+	int ret;
+
+	if (argc < 4) {
+		printf("Use:\n%s /dev/i2c-x mem_addr size [outfile]\n"
+		       "%s /dev/i2c-x -w mem_addr infile [page_size]\n",
+		       argv[0], argv[0]);
 		return 0;
 	}
-	sscanf(argv[2], "%d", &mem_addr);
-	sscanf(argv[3], "%d", &size);
-
-	if (size > BUFF_SIZE)
-		size = BUFF_SIZE;
 
 	fd = open(argv[1], O_RDWR);
 
-	if (!fd) {
+	if (fd < 0) {
 		printf("Error on opening the device file\n");
-		return 0;
+		return 1;
 	}
 
-	ioctl(fd, I2C_SLAVE, 0x50); /* 设置EEPROM地址 */
+	ioctl(fd, I2C_SLAVE, EEPROM_ADDR); /* 设置EEPROM地址 */
 	ioctl(fd, I2C_TIMEOUT, 1); /* 设置超时 */
-	ioctl(fd, I2C_RETRIES, 1); /* 设置重试次数 */
-
-	for (idx = 0; idx < size; ++idx, ++mem_addr) {
-		tmp.addr = mem_addr;
-		cswap = tmp.bytes[0];
-		tmp.bytes[0] = tmp.bytes[1];
-		tmp.bytes[1] = cswap;
-		write(fd, &tmp.addr, 2);
-		read(fd, &buf[idx], 1);
+	ioctl(fd, I2C_RETRIES, 0); /* ACK轮询时由我们自己重试 */
+
+	if (!strcmp(argv[2], "-w")) {
+		sscanf(argv[3], "%u", &mem_addr);
+		if (argc > 5)
+			sscanf(argv[5], "%u", &page_size);
+		if (page_size == 0 || page_size > PAGE_SIZE_MAX)
+			page_size = PAGE_SIZE_DEFAULT;
+		data = argc > 4 ? load_file(argv[4], &size) : NULL;
+		if (!data) {
+			printf("Error loading input file\n");
+			close(fd);
+			return 1;
+		}
+		if (mem_addr >= EEPROM_SIZE_MAX || size > EEPROM_SIZE_MAX - mem_addr) {
+			printf("0x%x + %lu bytes is beyond the 64KB address range\n",
+			       mem_addr, size);
+			free(data);
+			close(fd);
+			return 1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		ret = eeprom_page_write(fd, mem_addr, data, size, page_size);
+		if (!ret)
+			ret = eeprom_verify(fd, mem_addr, data, size);
+		fprintf(stderr, "Write %lu bytes page:%u syscalls:%lu time:%ldus%s\n",
+			size, page_size, nr_syscalls, elapsed_us(&t0),
+			ret ? " (failed)" : "");
+		free(data);
+		close(fd);
+		return ret ? 1 : 0;
 	}
-	buf[size] = 0;
+
+	sscanf(argv[2], "%u", &mem_addr);
+	sscanf(argv[3], "%lu", &size);
+	if (mem_addr >= EEPROM_SIZE_MAX || size > EEPROM_SIZE_MAX - mem_addr) {
+		printf("0x%x + %lu bytes is beyond the 64KB address range\n",
+		       mem_addr, size);
+		close(fd);
+		return 1;
+	}
+	if (argc > 4) {
+		out = fopen(argv[4], "wb");
+		if (!out) {
+			printf("Error on opening the output file\n");
+			close(fd);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = eeprom_stream_read(fd, mem_addr, size, out);
+	fflush(out);
+	fprintf(stderr, "Read %lu bytes syscalls:%lu time:%ldus%s\n",
+		size, nr_syscalls, elapsed_us(&t0), ret ? " (failed)" : "");
+
+	if (out != stdout)
+		fclose(out);
 	close(fd);
-	printf("Read %d char: %s\n", size, buf);
-	return 0;
-}
\ No newline at end of file
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+/********************** 说明 ***************************
+ * 多读者并发读xxx设备的sysfs eeprom文件（i2c_device.c中的xxx_bin_read），
+ * 用来观察驱动中合并读的效果：每个线程一个fd，在[0, window)内随机
+ * 取偏移，反复pread size字节。window越小、线程越多，请求之间的重叠
+ * 和相邻越多。
+ *
+ * 结束时输出总读次数、每秒读次数和延迟分布，并输出运行前后同一目录下
+ * coalesce_stats的差值（合并率、节省的总线时间）。与驱动的coalesce=0
+ * 对比时，先写/sys/module/<模块>/parameters/coalesce再运行一次。
+ * 没有影子缓存（shadow_mode=0）时读才会访问总线。
+ *
+ * 用法：i2c_eeprom_load [-t 线程数] [-d 秒] [-s size] [-w window] eeprom文件
+ *   例如：i2c_eeprom_load -t 16 -s 8 -w 128 /sys/bus/i2c/devices/0-0050/eeprom
+ * 编译：gcc -O2 -o i2c_eeprom_load i2c_eeprom_load.c -lpthread
+******************************************************/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <sys/types.h>
+
+#define MAX_THREADS	256
+#define MAX_SAMPLES	(1 << 20)	/* 每个线程最多记录的延迟样本 */
+#define MAX_STATS	16
+
+struct worker {
+	pthread_t tid;
+	int fd;
+	unsigned int seed;
+	unsigned long reads;
+	unsigned long errors;
+	unsigned long long *lat;
+	size_t nlat;
+};
+
+struct stat_line {
+	char name[32];
+	double val;
+};
+
+static const char *path;
+static size_t size = 8, window = 256;
+static volatile int stop;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char buf[4096];
+	unsigned long long t;
+	off_t off;
+
+	while (!stop) {
+		off = window > size ? rand_r(&w->seed) % (window - size + 1) : 0;
+		t = now_ns();
+		if (pread(w->fd, buf, size, off) != (ssize_t)size)
+			w->errors++;
+		if (w->nlat < MAX_SAMPLES)
+			w->lat[w->nlat++] = now_ns() - t;
+		w->reads++;
+	}
+
+	return NULL;
+}
+
+/* 读取"名字 值"格式的统计文件，返回行数，文件不存在时返回0 */
+static int read_stats(const char *file, struct stat_line *s)
+{
+	FILE *f = fopen(file, "r");
+	int n = 0;
+
+	if (!f)
+		return 0;
+	while (n < MAX_STATS && fscanf(f, "%31s %lf", s[n].name, &s[n].val) == 2)
+		n++;
+	fclose(f);
+
+	return n;
+}
+
+static double stat_delta(struct stat_line *a, struct stat_line *b, int n,
+			 const char *name)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!strcmp(b[i].name, name))
+			return b[i].val - a[i].val;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct worker workers[MAX_THREADS];
+	struct stat_line before[MAX_STATS], after[MAX_STATS];
+	char stats_path[4096], dir[4096];
+	unsigned long long *all, t;
+	unsigned long reads = 0, errors = 0;
+	double requests, extents;
+	int nthreads = 8, seconds = 5, nstats, i;
+	size_t n = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:s:w:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind != argc - 1 || nthreads < 1 || nthreads > MAX_THREADS ||
+	    seconds < 1 || size == 0 || size > 4096) {
+		printf("Use:\n%s [-t threads] [-d seconds] [-s size] [-w window] eeprom\n",
+		       argv[0]);
+		return 0;
+	}
+	path = argv[optind];
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	snprintf(stats_path, sizeof(stats_path), "%s/coalesce_stats", dirname(dir));
+	nstats = read_stats(stats_path, before);
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].fd = open(path, O_RDONLY);
+		workers[i].seed = i + 1;
+		workers[i].lat = malloc(MAX_SAMPLES * sizeof(unsigned long long));
+		if (workers[i].fd < 0 || !workers[i].lat) {
+			printf("Cannot open %s: %s\n", path, strerror(errno));
+			return 1;
+		}
+	}
+
+	t = now_ns();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&workers[i].tid, NULL, worker_fn, &workers[i]);
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		close(workers[i].fd);
+		reads += workers[i].reads;
+		errors += workers[i].errors;
+		n += workers[i].nlat;
+	}
+	t = now_ns() - t;
+
+	all = malloc((n ? n : 1) * sizeof(*all));
+	if (!all)
+		return 1;
+	n = 0;
+	for (i = 0; i < nthreads; i++) {
+		memcpy(all + n, workers[i].lat, workers[i].nlat * sizeof(*all));
+		n += workers[i].nlat;
+		free(workers[i].lat);
+	}
+	qsort(all, n, sizeof(*all), cmp_ull);
+
+	printf("threads:%d size:%zu window:%zu reads:%lu errors:%lu reads/s:%.0f\n",
+	       nthreads, size, window, reads, errors, reads * 1e9 / t);
+	if (n)
+		printf("latency(us): p50:%.1f p99:%.1f p999:%.1f max:%.1f\n",
+		       all[n / 2] / 1000.0, all[n * 99 / 100] / 1000.0,
+		       all[n * 999 / 1000] / 1000.0, all[n - 1] / 1000.0);
+
+	if (nstats && read_stats(stats_path, after) == nstats) {
+		requests = stat_delta(before, after, nstats, "requests");
+		extents = stat_delta(before, after, nstats, "extents");
+		printf("coalesce: requests:%.0f batches:%.0f extents:%.0f merge_ratio:%.2f "
+		       "bytes_read/requested:%.0f/%.0f saved_bus_time:%.0fus\n",
+		       requests, stat_delta(before, after, nstats, "batches"), extents,
+		       extents ? requests / extents : 0,
+		       stat_delta(before, after, nstats, "bytes_read"),
+		       stat_delta(before, after, nstats, "bytes_requested"),
+		       stat_delta(before, after, nstats, "saved_us"));
+	} else {
+		printf("coalesce: %s not available\n", stats_path);
+	}
+
+	free(all);
+
+	return 0;
+}
@@ -0,0 +1,259 @@
+/********************** 说明 ***************************
+ * 用户空间的寄存器表库：一个设备的寄存器（地址、宽度、字节序、
+ * 自动递增块）在编译时声明一次，由它生成预先分配好的最少i2c_msg
+ * 序列，连续的寄存器合并成一次突发读，结果直接解码到带类型的结构体，
+ * 读的热路径上没有任何堆分配，也不再手工拼i2c_msg。
+ *
+ * 声明：
+ *   #define ADXL345_REGS(X)				\
+ *   	X(devid,  0x00, uint8_t, BE, 0)		\
+ *   	X(datax,  0x32, int16_t, LE, 1)		\
+ *   	X(datay,  0x34, int16_t, LE, 1)		\
+ *   	X(dataz,  0x36, int16_t, LE, 1)
+ *   REGMAP_DECLARE(adxl345, 0, ADXL345_REGS)
+ * 得到struct adxl345_vals（每个寄存器一个对应类型的成员）和返回
+ * 常量表的adxl345_regmap()。X的参数依次是：成员名、寄存器地址、
+ * 成员类型（1/2/4字节）、字节序（LE/BE）、自动递增块号——芯片的
+ * 地址自动递增只在同一块内有效，突发读不会跨块。REGMAP_DECLARE的
+ * 第二个参数是突发读时要或到起始地址上的位（如LIS3系列的0x80）。
+ *
+ * 使用：
+ *   static struct regmap_plan plan;
+ *   struct adxl345_vals v;
+ *   regmap_plan_build(&plan, adxl345_regmap(), 0x53, 0, MSGS_PER_IOCTL);
+ *   regmap_read(fd, &plan, &v);
+ * 上例中datax~dataz合并成一次6字节的突发读，devid单独一对消息，
+ * 两对消息在一次I2C_RDWR中完成。
+******************************************************/
+
+#ifndef I2C_REGMAP_H
+#define I2C_REGMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS	42
+#endif
+
+#define REGMAP_MAX_REGS		256
+#define REGMAP_MAX_BURSTS	256
+#define REGMAP_MAX_BYTES	512	/* 所有突发读的总字节数，含合并进来的空洞 */
+#define REGMAP_BURST_MAX	256	/* 单次突发读的最大长度 */
+#define REGMAP_NO_MERGE		(-1)	/* merge_gap取此值时每个寄存器单独一对消息 */
+
+enum regmap_endian {
+	REGMAP_LE,
+	REGMAP_BE,
+};
+
+struct regmap_reg {
+	const char *name;
+	unsigned char addr;
+	unsigned char width;	/* 1、2或4字节 */
+	unsigned char endian;
+	unsigned char block;	/* 自动递增块号 */
+	unsigned short offset;	/* 在值结构体中的偏移 */
+};
+
+struct regmap_map {
+	const char *name;
+	const struct regmap_reg *regs;
+	unsigned int nr;
+	unsigned char autoinc;	/* 突发读时或到起始地址上的位 */
+};
+
+#define REGMAP_FIELD(name, addr, type, endian, block)	type name;
+#define REGMAP_ENTRY(name, addr, type, endian, block)			\
+	{ #name, addr, sizeof(type), REGMAP_##endian, block,		\
+	  offsetof(regmap_vals_t, name) },
+#define REGMAP_CHECK(name, addr, type, endian, block)			\
+	_Static_assert(sizeof(type) == 1 || sizeof(type) == 2 ||	\
+		       sizeof(type) == 4, #name ": width must be 1, 2 or 4");
+
+/* 生成值结构体和寄存器常量表，表在编译时就确定了 */
+#define REGMAP_DECLARE(map, autoinc_bit, LIST)					\
+	struct map##_vals {							\
+		LIST(REGMAP_FIELD)						\
+	};									\
+	static inline const struct regmap_map *map##_regmap(void)		\
+	{									\
+		typedef struct map##_vals regmap_vals_t;			\
+		static const struct regmap_reg regs[] = { LIST(REGMAP_ENTRY) };	\
+		static const struct regmap_map m = {				\
+			#map, regs, sizeof(regs) / sizeof(regs[0]), autoinc_bit	\
+		};								\
+		LIST(REGMAP_CHECK)						\
+		return &m;							\
+	}
+
+/* 由寄存器表生成的消息序列，一般定义为静态变量，只在启动时生成一次 */
+struct regmap_plan {
+	const struct regmap_map *map;
+	unsigned int nmsgs;
+	unsigned int msgs_per_ioctl;
+	unsigned long nr_ioctls;		/* 累计发出的I2C_RDWR次数 */
+	struct i2c_msg msgs[REGMAP_MAX_BURSTS * 2];
+	unsigned char addrs[REGMAP_MAX_BURSTS];	/* 每次突发读的起始地址 */
+	unsigned short pos[REGMAP_MAX_REGS];	/* 每个寄存器在raw中的位置 */
+	unsigned char raw[REGMAP_MAX_BYTES];
+};
+
+/* 按地址排序的寄存器下标，插入排序，寄存器表通常本来就是有序的 */
+static inline void regmap_sort(const struct regmap_map *map, unsigned short *order)
+{
+	unsigned int i, j;
+	unsigned short t;
+
+	for (i = 0; i < map->nr; i++) {
+		t = i;
+		for (j = i; j > 0 && map->regs[order[j - 1]].addr > map->regs[t].addr; j--)
+			order[j] = order[j - 1];
+		order[j] = t;
+	}
+}
+
+static inline void regmap_add_burst(struct regmap_plan *plan, int slave,
+				    unsigned int start, unsigned int len,
+				    unsigned int raw_off)
+{
+	unsigned int b = plan->nmsgs / 2;
+
+	plan->addrs[b] = start | (len > 1 ? plan->map->autoinc : 0);
+
+	plan->msgs[plan->nmsgs].addr = slave;
+	plan->msgs[plan->nmsgs].flags = 0;
+	plan->msgs[plan->nmsgs].len = 1;
+	plan->msgs[plan->nmsgs].buf = &plan->addrs[b];
+	plan->nmsgs++;
+
+	plan->msgs[plan->nmsgs].addr = slave;
+	plan->msgs[plan->nmsgs].flags = I2C_M_RD;
+	plan->msgs[plan->nmsgs].len = len;
+	plan->msgs[plan->nmsgs].buf = &plan->raw[raw_off];
+	plan->nmsgs++;
+}
+
+/*
+ * 生成消息序列：按地址顺序扫描，同一块内、与当前突发读之间的空洞
+ * 不超过merge_gap字节的寄存器并入当前突发读（多读几个字节比多一对
+ * 消息——重复START加地址和寄存器地址——便宜）。merge_gap为
+ * REGMAP_NO_MERGE时每个寄存器单独一对消息。
+ * msgs_per_ioctl为每次I2C_RDWR最多携带的消息数，会取成偶数。
+ * 成功返回突发读的次数，表太大时返回-E2BIG。
+ */
+static inline int regmap_plan_build(struct regmap_plan *plan,
+				    const struct regmap_map *map, int slave,
+				    int merge_gap, unsigned int msgs_per_ioctl)
+{
+	unsigned short order[REGMAP_MAX_REGS];
+	const struct regmap_reg *r;
+	unsigned int start = 0, end = 0, raw_off = 0;
+	unsigned int i;
+	int open = 0;
+
+	if (map->nr > REGMAP_MAX_REGS)
+		return -E2BIG;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->map = map;
+	plan->msgs_per_ioctl = msgs_per_ioctl & ~1U;
+	if (plan->msgs_per_ioctl == 0 || plan->msgs_per_ioctl > I2C_RDWR_IOCTL_MAX_MSGS)
+		plan->msgs_per_ioctl = I2C_RDWR_IOCTL_MAX_MSGS & ~1U;
+
+	regmap_sort(map, order);
+	for (i = 0; i < map->nr; i++) {
+		r = &map->regs[order[i]];
+
+		if (open && merge_gap != REGMAP_NO_MERGE &&
+		    r->block == map->regs[order[i - 1]].block &&
+		    r->addr <= end + merge_gap &&
+		    r->addr + r->width - start <= REGMAP_BURST_MAX) {
+			/* 并入当前突发读，重叠的寄存器直接共用 */
+			if (r->addr + r->width > end)
+				end = r->addr + r->width;
+		} else {
+			if (open) {
+				if (plan->nmsgs / 2 == REGMAP_MAX_BURSTS)
+					return -E2BIG;
+				regmap_add_burst(plan, slave, start, end - start, raw_off);
+				raw_off += end - start;
+			}
+			start = r->addr;
+			end = r->addr + r->width;
+			open = 1;
+		}
+		if (raw_off + end - start > REGMAP_MAX_BYTES)
+			return -E2BIG;
+		plan->pos[order[i]] = raw_off + r->addr - start;
+	}
+	if (open) {
+		if (plan->nmsgs / 2 == REGMAP_MAX_BURSTS)
+			return -E2BIG;
+		regmap_add_burst(plan, slave, start, end - start, raw_off);
+	}
+
+	return plan->nmsgs / 2;
+}
+
+/* 把raw中的数据按宽度和字节序解码到值结构体 */
+static inline void regmap_decode(const struct regmap_plan *plan, void *vals)
+{
+	const struct regmap_map *map = plan->map;
+	const struct regmap_reg *r;
+	const unsigned char *p;
+	uint32_t v;
+	unsigned int i, j;
+
+	for (i = 0; i < map->nr; i++) {
+		r = &map->regs[i];
+		p = &plan->raw[plan->pos[i]];
+		v = 0;
+		for (j = 0; j < r->width; j++)
+			v |= (uint32_t)p[r->endian == REGMAP_BE ? j : r->width - 1 - j] <<
+				(8 * (r->width - 1 - j));
+
+		switch (r->width) {
+		case 1:
+			*(uint8_t *)((char *)vals + r->offset) = v;
+			break;
+		case 2:
+			*(uint16_t *)((char *)vals + r->offset) = v;
+			break;
+		default:
+			*(uint32_t *)((char *)vals + r->offset) = v;
+			break;
+		}
+	}
+}
+
+/* 执行整个消息序列并解码，vals为NULL时只读不解码。
+ * 返回0或最后一次失败的ioctl的-errno，失败的批次不影响其他批次 */
+static inline int regmap_read(int fd, struct regmap_plan *plan, void *vals)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < plan->nmsgs; i += rdwr.nmsgs) {
+		rdwr.msgs = &plan->msgs[i];
+		rdwr.nmsgs = plan->nmsgs - i;
+		if (rdwr.nmsgs > plan->msgs_per_ioctl)
+			rdwr.nmsgs = plan->msgs_per_ioctl;
+		plan->nr_ioctls++;
+		if (ioctl(fd, I2C_RDWR, &rdwr) < 0)
+			err = -errno;
+	}
+
+	if (vals)
+		regmap_decode(plan, vals);
+
+	return err;
+}
+
+#endif /* I2C_REGMAP_H */
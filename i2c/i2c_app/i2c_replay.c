@@ -0,0 +1,311 @@
+/********************** 说明 ***************************
+ * 回放i2c传输捕获文件（格式见i2c_trace.h，来自xxx_i2c的debugfs
+ * trace文件或者i2c_sim/i2c_trace.c），把同样的传输序列用I2C_RDWR
+ * 发到/dev/i2c-N（或者模拟器），用来在真实的负载下对比驱动修改
+ * 前后的性能。
+ *
+ * 每条记录原样作为一次I2C_RDWR发出：写消息使用记录下来的数据，
+ * 读消息只用长度。捕获时每条消息只记录前若干字节，数据不完整的写
+ * 默认跳过（计入short_writes），否则会把0写进真实的芯片；确实需要
+ * 时用-z把缺少的部分补0发出。默认按记录的时间间隔发出，
+ * -f时不等待、尽快发出。结束时输出回放的传输数、结果与记录不同的
+ * 传输数、每次传输的延迟分布，按时间回放时还输出发出时刻相对于
+ * 计划时刻的延迟。
+ *
+ * 用法：i2c_replay [-f] [-z] [-b from=to,...] [-n loops] trace_file
+ *   -f  尽快回放
+ *   -z  数据不完整的写消息补0发出，而不是跳过
+ *   -b  总线号映射，如-b 3=1把记录中总线3上的传输发到/dev/i2c-1
+ *   -n  重复回放的次数，默认1
+ * 编译：gcc -O2 -o i2c_replay i2c_replay.c
+******************************************************/
+
+#include <stdio.h>
+#include <linux/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c_trace.h"
+
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS	42
+#endif
+
+#define MAX_BUSES		256
+#define MSG_LEN_MAX		8192	/* i2c-dev中单条消息的上限 */
+
+struct record {
+	size_t off;
+	unsigned long long timestamp;
+};
+
+static unsigned char *trace;
+static size_t trace_size;
+static struct record *records;
+static size_t nr_records;
+
+static int bus_map[MAX_BUSES];
+static int bus_fd[MAX_BUSES];
+static unsigned char msg_data[I2C_RDWR_IOCTL_MAX_MSGS][MSG_LEN_MAX];
+static int zero_pad;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_record(const void *a, const void *b)
+{
+	const struct record *ra = a, *rb = b;
+
+	if (ra->timestamp != rb->timestamp)
+		return ra->timestamp < rb->timestamp ? -1 : 1;
+
+	/* 时间戳相同时保持文件中的顺序 */
+	return ra->off < rb->off ? -1 : ra->off > rb->off;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int load(const char *path)
+{
+	struct i2c_trace_file_hdr hdr;
+	struct i2c_trace_xfer x;
+	struct stat st;
+	size_t pos, len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	trace_size = st.st_size;
+	trace = malloc(trace_size);
+	if (!trace || read(fd, trace, trace_size) != (ssize_t)trace_size) {
+		printf("Cannot read %s\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	memcpy(&hdr, trace, trace_size < sizeof(hdr) ? trace_size : sizeof(hdr));
+	if (trace_size < sizeof(hdr) || hdr.magic != I2C_TRACE_MAGIC ||
+	    hdr.version != I2C_TRACE_VERSION) {
+		printf("%s: not an i2c trace file\n", path);
+		return -1;
+	}
+
+	/* 建立记录索引，记录的长度要逐条消息累加 */
+	records = malloc((trace_size / sizeof(x) + 1) * sizeof(*records));
+	if (!records)
+		return -1;
+	for (pos = sizeof(hdr); pos < trace_size; pos += len) {
+		len = i2c_trace_next(trace, trace_size, pos);
+		if (!len) {
+			printf("%s: truncated record at offset %zu\n", path, pos);
+			break;
+		}
+		memcpy(&x, trace + pos, sizeof(x));
+		records[nr_records].off = pos;
+		records[nr_records].timestamp = x.timestamp;
+		nr_records++;
+	}
+	qsort(records, nr_records, sizeof(*records), cmp_record);
+
+	printf("%s: payload %u bytes/msg, %zu transfers\n", path, hdr.payload,
+	       nr_records);
+
+	return 0;
+}
+
+static int get_fd(unsigned int bus)
+{
+	char path[32];
+
+	if (bus_fd[bus] < 0) {
+		snprintf(path, sizeof(path), "/dev/i2c-%d", bus_map[bus]);
+		bus_fd[bus] = open(path, O_RDWR);
+		if (bus_fd[bus] < 0)
+			printf("Cannot open %s: %s\n", path, strerror(errno));
+	}
+
+	return bus_fd[bus];
+}
+
+/* 由记录构造I2C_RDWR的消息，不能回放时返回-1 */
+static int build(const struct record *r, struct i2c_trace_xfer *x,
+		 struct i2c_msg *msgs, unsigned long *short_writes)
+{
+	struct i2c_trace_msg m;
+	size_t pos = r->off + sizeof(*x);
+	unsigned int i;
+
+	memcpy(x, trace + r->off, sizeof(*x));
+	if (x->nmsgs == 0 || x->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)
+		return -1;
+
+	for (i = 0; i < x->nmsgs; i++) {
+		memcpy(&m, trace + pos, sizeof(m));
+		pos += sizeof(m);
+		if (m.len > MSG_LEN_MAX)
+			return -1;
+
+		msgs[i].addr = m.addr;
+		msgs[i].flags = m.flags;
+		msgs[i].len = m.len;
+		msgs[i].buf = msg_data[i];
+
+		if (m.flags & I2C_M_RD) {
+			/* i2c-dev要求RECV_LEN的消息能容纳最长的块 */
+			if (m.flags & I2C_M_RECV_LEN) {
+				msg_data[i][0] = 1;
+				msgs[i].len = I2C_SMBUS_BLOCK_MAX + 1;
+			}
+		} else {
+			memcpy(msg_data[i], trace + pos, m.data_len);
+			if (m.data_len < m.len) {
+				(*short_writes)++;
+				if (!zero_pad)
+					return -1;
+				memset(msg_data[i] + m.data_len, 0, m.len - m.data_len);
+			}
+		}
+		pos += m.data_len;
+	}
+
+	return 0;
+}
+
+static void print_dist(const char *name, unsigned long long *v, size_t n)
+{
+	if (!n)
+		return;
+	qsort(v, n, sizeof(*v), cmp_ull);
+	printf("%s(us): p50:%.1f p99:%.1f p999:%.1f max:%.1f\n", name,
+	       v[n / 2] / 1000.0, v[n * 99 / 100] / 1000.0,
+	       v[n * 999 / 1000] / 1000.0, v[n - 1] / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct i2c_rdwr_ioctl_data rdwr;
+	struct i2c_trace_xfer x;
+	unsigned long long *lat, *late;
+	unsigned long long t0, start, target, t, span;
+	unsigned long replayed = 0, skipped = 0, mismatched = 0, short_writes = 0;
+	size_t nlat = 0, nlate = 0, i;
+	struct timespec ts;
+	int fast = 0, loops = 1, loop, from, to, ret, fd;
+	char *tok;
+	int opt;
+
+	for (i = 0; i < MAX_BUSES; i++) {
+		bus_map[i] = i;
+		bus_fd[i] = -1;
+	}
+
+	while ((opt = getopt(argc, argv, "fzb:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			fast = 1;
+			break;
+		case 'z':
+			zero_pad = 1;
+			break;
+		case 'b':
+			for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ","))
+				if (sscanf(tok, "%d=%d", &from, &to) == 2 &&
+				    from >= 0 && from < MAX_BUSES)
+					bus_map[from] = to;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind != argc - 1 || loops < 1) {
+		printf("Use:\n%s [-f] [-z] [-b from=to,...] [-n loops] trace_file\n", argv[0]);
+		return 0;
+	}
+
+	if (load(argv[optind]) < 0 || nr_records == 0)
+		return 1;
+
+	lat = malloc(nr_records * loops * sizeof(*lat));
+	late = malloc(nr_records * loops * sizeof(*late));
+	if (!lat || !late)
+		return 1;
+
+	span = records[nr_records - 1].timestamp - records[0].timestamp;
+	t0 = now_ns();
+	for (loop = 0; loop < loops; loop++) {
+		/* 每一遍都从当前时刻开始按记录的间隔发出 */
+		start = now_ns();
+		for (i = 0; i < nr_records; i++) {
+			if (build(&records[i], &x, msgs, &short_writes) < 0 ||
+			    (fd = get_fd(x.bus)) < 0) {
+				skipped++;
+				continue;
+			}
+
+			if (!fast) {
+				target = start + records[i].timestamp - records[0].timestamp;
+				ts.tv_sec = target / 1000000000ULL;
+				ts.tv_nsec = target % 1000000000ULL;
+				if (now_ns() < target)
+					clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+				late[nlate++] = now_ns() - target;
+			}
+
+			rdwr.msgs = msgs;
+			rdwr.nmsgs = x.nmsgs;
+			t = now_ns();
+			ret = ioctl(fd, I2C_RDWR, &rdwr);
+			lat[nlat++] = now_ns() - t;
+			if (ret < 0)
+				ret = -errno;
+
+			replayed++;
+			if (ret != x.result)
+				mismatched++;
+		}
+	}
+	t = now_ns() - t0;
+
+	printf("replayed:%lu skipped:%lu result_mismatch:%lu short_writes:%lu\n",
+	       replayed, skipped, mismatched, short_writes);
+	printf("recorded span:%lluus replay time:%lluus (%s)\n", span / 1000,
+	       t / 1000 / loops, fast ? "as fast as possible" : "recorded timing");
+	print_dist("latency", lat, nlat);
+	print_dist("lateness", late, nlate);
+
+	for (i = 0; i < MAX_BUSES; i++)
+		if (bus_fd[i] >= 0)
+			close(bus_fd[i]);
+
+	return 0;
+}
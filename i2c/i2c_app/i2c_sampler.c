@@ -0,0 +1,581 @@
+/********************** 说明 ***************************
+ * 多总线并行的寄存器采样守护进程，替代用cron反复运行i2c_dev_ioctl
+ * 等一次性工具：不再每次都付出进程启动、open()和ioctl()设置的开销，
+ * 各条总线之间也不再串行。
+ *
+ * 配置文件每行一个采样任务，#开头为注释：
+ *   <总线> <从地址> <寄存器[:个数]>[,<寄存器[:个数]>...] <周期us>
+ * 例如：
+ *   1 0x1d 0x00:6,0x20:2 10000
+ *   /dev/i2c-3 0x50 0x00:16 1000000
+ *
+ * 每条总线一个工作线程，只open一次；每个任务的i2c_msg数组（每个寄存器
+ * 区间一对“写地址+读数据”）在启动时就建好，一次I2C_RDWR读回整个任务。
+ * 每个任务一个timerfd（CLOCK_MONOTONIC，绝对到期时间），抖动只取决于
+ * 调度延迟，不会随处理时间累积漂移。
+ *
+ * 结果写入POSIX共享内存（/dev/shm/<名字>）中的环形缓冲区，每个寄存器
+ * 区间一个槽。多个工作线程用原子加抢占槽位，每个槽带序号，读者按
+ * 序号校验读到的是完整的一条，整个读取过程不需要任何系统调用，写者
+ * 也从不等待读者，读者太慢时旧数据被覆盖。
+ *
+ * 采样：i2c_sampler [-n 名字] [-s 槽数] [-p 实时优先级] 配置文件
+ * 读取：i2c_sampler -r [-n 名字]    （打印环中的新样本，供调试）
+ * 编译：gcc -O2 -pthread -o i2c_sampler i2c_sampler.c -lrt
+******************************************************/
+
+#include <stdio.h>
+#include <linux/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS	42
+#endif
+
+#define MAX_BUSES		16
+#define MAX_JOBS		64
+#define MAX_RANGES		(I2C_RDWR_IOCTL_MAX_MSGS / 2)	/* 一次I2C_RDWR读完一个任务 */
+#define SAMPLE_MAX		32	/* 每个寄存器区间最多读回的字节数 */
+#define SLOTS_DEFAULT		4096	/* 必须是2的幂 */
+#define SHM_NAME_DEFAULT	"/i2c_sampler"
+#define RING_MAGIC		0x49324352	/* "I2CR" */
+#define RING_VERSION		1
+
+/* 共享内存中的一个样本。seq为奇数表示正在写；为偶数时等于2*(序号+1) */
+struct ring_slot {
+	_Atomic uint64_t seq;
+	int64_t timestamp;	/* 定时器到期时间，CLOCK_MONOTONIC，单位ns */
+	int32_t status;		/* 0或负的errno */
+	uint16_t bus;
+	uint16_t slave;
+	uint8_t reg;
+	uint8_t len;
+	uint8_t data[SAMPLE_MAX];
+	uint8_t pad[6];
+};
+
+struct ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_slots;
+	uint32_t slot_size;
+	_Atomic uint64_t head;	/* 下一个要写的样本序号 */
+	uint8_t pad[40];	/* head独占一个cache line */
+	struct ring_slot slots[];
+};
+
+struct range {
+	unsigned char reg;
+	unsigned char len;
+};
+
+struct job {
+	unsigned int bus;
+	unsigned int slave;
+	unsigned int nr_ranges;
+	struct range ranges[MAX_RANGES];
+	unsigned long period_us;
+
+	/* 启动时建好，采样时直接提交 */
+	struct i2c_msg msgs[MAX_RANGES * 2];
+	unsigned char data[MAX_RANGES][SAMPLE_MAX];
+	struct i2c_rdwr_ioctl_data rdwr;
+	int tfd;
+	int64_t next_ns;	/* 下一次到期的时间 */
+
+	unsigned long samples;
+	unsigned long errors;
+	unsigned long missed;	/* 处理不过来而错过的周期数 */
+	long max_jitter_ns;
+};
+
+struct bus_worker {
+	unsigned int bus;
+	int fd;
+	pthread_t thread;
+	unsigned int nr_jobs;
+	struct job *jobs[MAX_JOBS];
+};
+
+static struct job jobs[MAX_JOBS];
+static unsigned int nr_jobs;
+static struct bus_worker workers[MAX_BUSES];
+static unsigned int nr_workers;
+static struct ring_header *ring;
+static int rt_prio;
+static volatile sig_atomic_t stop;
+
+static int64_t ts_ns(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* 抢占一个槽写入样本，多个工作线程并发调用，不加锁 */
+static void ring_publish(const struct job *job, unsigned int r, int64_t when,
+			 int status)
+{
+	uint64_t idx = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+	struct ring_slot *slot = &ring->slots[idx & (ring->nr_slots - 1)];
+
+	atomic_store_explicit(&slot->seq, idx * 2 + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->timestamp = when;
+	slot->status = status;
+	slot->bus = job->bus;
+	slot->slave = job->slave;
+	slot->reg = job->ranges[r].reg;
+	slot->len = job->ranges[r].len;
+	memcpy(slot->data, job->data[r], job->ranges[r].len);
+
+	atomic_store_explicit(&slot->seq, idx * 2 + 2, memory_order_release);
+}
+
+/* 读出序号为idx的样本，被覆盖或正在写时返回-1 */
+static int ring_read(uint64_t idx, struct ring_slot *out)
+{
+	const struct ring_slot *slot = &ring->slots[idx & (ring->nr_slots - 1)];
+	uint64_t seq;
+
+	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (seq != idx * 2 + 2)
+		return -1;
+
+	out->timestamp = slot->timestamp;
+	out->status = slot->status;
+	out->bus = slot->bus;
+	out->slave = slot->slave;
+	out->reg = slot->reg;
+	out->len = slot->len;
+	memcpy(out->data, slot->data, sizeof(out->data));
+
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+		return -1;
+
+	return 0;
+}
+
+static int ring_create(const char *name, unsigned int nr_slots)
+{
+	size_t size = sizeof(*ring) + (size_t)nr_slots * sizeof(struct ring_slot);
+	int fd;
+
+	fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+		return -1;
+
+	memset(ring, 0, size);
+	ring->nr_slots = nr_slots;
+	ring->slot_size = sizeof(struct ring_slot);
+	ring->version = RING_VERSION;
+	atomic_thread_fence(memory_order_release);
+	ring->magic = RING_MAGIC; /* 最后写magic，读者看到它说明头已就绪 */
+
+	return 0;
+}
+
+static int ring_attach(const char *name)
+{
+	struct ring_header hdr;
+	size_t size;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != RING_MAGIC ||
+	    hdr.version != RING_VERSION || hdr.slot_size != sizeof(struct ring_slot)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	size = sizeof(*ring) + (size_t)hdr.nr_slots * sizeof(struct ring_slot);
+	ring = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	return ring == MAP_FAILED ? -1 : 0;
+}
+
+/* 打印环中的新样本，只在环被填满前来不及读时才会跳过 */
+static int dump_ring(const char *name)
+{
+	struct ring_slot s;
+	struct timespec idle = { 0, 1000000 };
+	uint64_t next, head;
+	unsigned int i;
+
+	if (ring_attach(name) < 0) {
+		printf("Error attaching to %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	next = atomic_load_explicit(&ring->head, memory_order_acquire);
+	while (!stop) {
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		if (next == head) {
+			nanosleep(&idle, NULL); /* 只是调试用的打印，不必忙等 */
+			continue;
+		}
+		if (head - next > ring->nr_slots) {
+			printf("overrun: skipped %llu samples\n",
+			       (unsigned long long)(head - next - ring->nr_slots));
+			next = head - ring->nr_slots;
+		}
+		for (; next != head; next++) {
+			/* 写者抢到了槽位还没写完，下一轮再读 */
+			if (ring_read(next, &s) < 0)
+				break;
+			printf("%lld.%06lld i2c-%u 0x%02x reg:%02x", (long long)s.timestamp / 1000000000,
+			       (long long)s.timestamp % 1000000000 / 1000, s.bus, s.slave, s.reg);
+			if (s.status)
+				printf(" error:%d", s.status);
+			else
+				for (i = 0; i < s.len; i++)
+					printf(" %02x", s.data[i]);
+			printf("\n");
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+static int parse_ranges(struct job *job, char *spec)
+{
+	unsigned int reg, len;
+	char *tok, *save;
+
+	for (tok = strtok_r(spec, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (job->nr_ranges == MAX_RANGES)
+			return -1;
+		len = 1;
+		if (sscanf(tok, "%i:%u", &reg, &len) < 1)
+			return -1;
+		if (reg > 0xff || len == 0 || len > SAMPLE_MAX)
+			return -1;
+		job->ranges[job->nr_ranges].reg = reg;
+		job->ranges[job->nr_ranges].len = len;
+		job->nr_ranges++;
+	}
+
+	return job->nr_ranges ? 0 : -1;
+}
+
+static int parse_config(const char *path)
+{
+	char line[512], bus[64], slave[16], ranges[384];
+	unsigned long period;
+	unsigned int lineno = 0;
+	struct job *job;
+	FILE *fp;
+	char *p;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		p = line + strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || *p == '\0')
+			continue;
+		if (nr_jobs == MAX_JOBS) {
+			printf("Too many jobs, ignoring line %u\n", lineno);
+			break;
+		}
+
+		job = &jobs[nr_jobs];
+		memset(job, 0, sizeof(*job));
+		if (sscanf(p, "%63s %15s %383s %lu", bus, slave, ranges, &period) != 4 ||
+		    sscanf(!strncmp(bus, "/dev/i2c-", 9) ? bus + 9 : bus, "%u", &job->bus) != 1 ||
+		    sscanf(slave, "%i", &job->slave) != 1 || job->slave > 0x7f ||
+		    parse_ranges(job, ranges) < 0 || period == 0) {
+			printf("Bad config at line %u\n", lineno);
+			fclose(fp);
+			return -1;
+		}
+		job->period_us = period;
+		nr_jobs++;
+	}
+
+	fclose(fp);
+	return nr_jobs ? 0 : -1;
+}
+
+/* 一次建好整个任务的消息数组，之后每个周期只提交一次I2C_RDWR */
+static void job_build_msgs(struct job *job)
+{
+	unsigned int r;
+
+	for (r = 0; r < job->nr_ranges; r++) {
+		job->msgs[r * 2].addr = job->slave;
+		job->msgs[r * 2].flags = 0;
+		job->msgs[r * 2].len = 1;
+		job->msgs[r * 2].buf = &job->ranges[r].reg;
+
+		job->msgs[r * 2 + 1].addr = job->slave;
+		job->msgs[r * 2 + 1].flags = I2C_M_RD;
+		job->msgs[r * 2 + 1].len = job->ranges[r].len;
+		job->msgs[r * 2 + 1].buf = job->data[r];
+	}
+	job->rdwr.msgs = job->msgs;
+	job->rdwr.nmsgs = job->nr_ranges * 2;
+}
+
+static int job_arm_timer(struct job *job, const struct timespec *start)
+{
+	struct itimerspec its;
+
+	job->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (job->tfd < 0)
+		return -1;
+
+	its.it_value = *start;
+	job->next_ns = ts_ns(start);
+	its.it_interval.tv_sec = job->period_us / 1000000;
+	its.it_interval.tv_nsec = job->period_us % 1000000 * 1000;
+
+	return timerfd_settime(job->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void job_sample(struct bus_worker *w, struct job *job, int64_t when)
+{
+	struct timespec now;
+	unsigned int r;
+	long jitter;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	jitter = ts_ns(&now) - when;
+	if (jitter > job->max_jitter_ns)
+		job->max_jitter_ns = jitter;
+
+	ret = ioctl(w->fd, I2C_RDWR, &job->rdwr);
+	if (ret < 0) {
+		ret = -errno;
+		job->errors++;
+	} else {
+		ret = 0;
+		job->samples++;
+	}
+
+	for (r = 0; r < job->nr_ranges; r++)
+		ring_publish(job, r, when, ret);
+}
+
+static void *bus_worker_thread(void *arg)
+{
+	struct bus_worker *w = arg;
+	struct pollfd pfds[MAX_JOBS];
+	struct sched_param sp;
+	uint64_t expirations;
+	unsigned int i;
+	int64_t when;
+
+	if (rt_prio) {
+		sp.sched_priority = rt_prio;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))
+			printf("i2c-%u: cannot set SCHED_FIFO, running with normal priority\n",
+			       w->bus);
+	}
+
+	for (i = 0; i < w->nr_jobs; i++) {
+		pfds[i].fd = w->jobs[i]->tfd;
+		pfds[i].events = POLLIN;
+	}
+
+	while (!stop) {
+		if (poll(pfds, w->nr_jobs, 200) <= 0)
+			continue;
+
+		for (i = 0; i < w->nr_jobs; i++) {
+			struct job *job = w->jobs[i];
+
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			if (read(job->tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+				continue;
+			/* 错过的周期不补采，只采最近一次到期 */
+			job->missed += expirations - 1;
+			when = job->next_ns + (int64_t)(expirations - 1) * job->period_us * 1000;
+			job->next_ns = when + (int64_t)job->period_us * 1000;
+			job_sample(w, job, when);
+		}
+	}
+
+	return NULL;
+}
+
+static struct bus_worker *get_worker(unsigned int bus)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_workers; i++)
+		if (workers[i].bus == bus)
+			return &workers[i];
+	if (nr_workers == MAX_BUSES)
+		return NULL;
+
+	workers[nr_workers].bus = bus;
+	return &workers[nr_workers++];
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *shm_name = SHM_NAME_DEFAULT;
+	unsigned int nr_slots = SLOTS_DEFAULT;
+	struct bus_worker *w;
+	struct timespec start;
+	char path[32];
+	int reader = 0;
+	unsigned int i, j;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "rn:s:p:")) != -1) {
+		switch (opt) {
+		case 'r':
+			reader = 1;
+			break;
+		case 'n':
+			shm_name = optarg;
+			break;
+		case 's':
+			nr_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			rt_prio = atoi(optarg);
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (reader)
+		return dump_ring(shm_name);
+
+	if (optind != argc - 1) {
+		printf("Use:\n%s [-n shm_name] [-s slots] [-p rt_prio] config\n"
+		       "%s -r [-n shm_name]\n", argv[0], argv[0]);
+		return 0;
+	}
+	if (nr_slots == 0 || (nr_slots & (nr_slots - 1))) {
+		printf("Number of slots must be a power of 2\n");
+		return 1;
+	}
+
+	if (parse_config(argv[optind]) < 0) {
+		printf("Error loading config %s\n", argv[optind]);
+		return 1;
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		w = get_worker(jobs[i].bus);
+		if (!w || w->nr_jobs == MAX_JOBS) {
+			printf("Too many buses\n");
+			return 1;
+		}
+		job_build_msgs(&jobs[i]);
+		w->jobs[w->nr_jobs++] = &jobs[i];
+	}
+
+	if (ring_create(shm_name, nr_slots) < 0) {
+		printf("Error creating shared memory %s: %s\n", shm_name, strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		w = &workers[i];
+		snprintf(path, sizeof(path), "/dev/i2c-%u", w->bus);
+		w->fd = open(path, O_RDWR);
+		if (w->fd < 0) {
+			printf("Error on opening %s\n", path);
+			return 1;
+		}
+		if (ioctl(w->fd, I2C_TIMEOUT, 1) < 0 ||
+		    ioctl(w->fd, I2C_RETRIES, 1) < 0) {
+			printf("Error setting up %s: %s\n", path, strerror(errno));
+			return 1;
+		}
+	}
+
+	/* 所有任务从同一时刻开始，留出启动线程的时间 */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	start.tv_nsec += 10000000;
+	if (start.tv_nsec >= 1000000000) {
+		start.tv_sec++;
+		start.tv_nsec -= 1000000000;
+	}
+	for (i = 0; i < nr_jobs; i++) {
+		if (job_arm_timer(&jobs[i], &start) < 0) {
+			printf("Error creating timer: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		ret = pthread_create(&workers[i].thread, NULL, bus_worker_thread,
+				     &workers[i]);
+		if (ret) {
+			printf("Error creating thread: %s\n", strerror(ret));
+			/* 已经启动的线程最多200ms内看到stop后退出 */
+			stop = 1;
+			nr_workers = i;
+			break;
+		}
+	}
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+	if (ret) {
+		shm_unlink(shm_name);
+		return 1;
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		w = &workers[i];
+		for (j = 0; j < w->nr_jobs; j++)
+			printf("i2c-%u 0x%02x period:%luus samples:%lu errors:%lu missed:%lu max_jitter:%ldus\n",
+			       w->bus, w->jobs[j]->slave, w->jobs[j]->period_us,
+			       w->jobs[j]->samples, w->jobs[j]->errors, w->jobs[j]->missed,
+			       w->jobs[j]->max_jitter_ns / 1000);
+		close(w->fd);
+	}
+	shm_unlink(shm_name);
+
+	return 0;
+}
@@ -0,0 +1,420 @@
+/********************** 说明 ***************************
+ * 快速扫描总线上有哪些从设备，相当于用户空间的i2c_new_probed_device()
+ * 和address_list探测，但不需要为每个地址分别open/ioctl/read：
+ * 一个总线只open一次，用I2C_RDWR把多个地址的探测消息打包进同一次
+ * ioctl，各条总线各用一个线程并行扫描。
+ *
+ * 探测方式按I2C_FUNCS选择（-s可指定）：
+ * quick:      每个地址一条0长度写消息（SMBus quick），0x30~0x37和
+ *             0x50~0x5f改用读1字节，避免写保护位之类的副作用（同i2cdetect）。
+ *             一批消息中有地址不应答时i2c_transfer()就结束了：有的适配器
+ *             返回已完成的消息数，由此知道哪个地址不应答，继续探测后面的
+ *             地址；返回负的错误码的适配器无法知道是哪个地址，之后退回
+ *             每次ioctl只探测一个地址。
+ * read:       全部用读1字节探测，打包方式同上。
+ * ignore_nak: 需要I2C_FUNC_PROTOCOL_MANGLING。每个地址一条带I2C_M_IGNORE_NAK
+ *             的读1字节消息，不应答的地址读到0xff，每次ioctl探测42个地址，
+ *             整条总线3次ioctl。读到0xff的设备（如擦除过的EEPROM）会被
+ *             漏掉，只在-F时使用。
+ * smbus:      适配器不支持I2C_FUNC_I2C时，逐个地址用I2C_SMBUS quick或读字节。
+ *
+ * 用法：i2c_scan [-b 总线号,...] [-s 方式] [-t] [-F] [-j]
+ *   -b  要扫描的总线，默认/dev下所有的i2c-N
+ *   -t  同时扫描10位地址空间（需要I2C_FUNC_10BIT_ADDR）
+ *   -F  自动选择时允许使用ignore_nak
+ *   -j  每条总线输出一行JSON，默认输出CSV：bus,addr,strategy
+ * 每条总线的ioctl次数和耗时输出到标准错误
+******************************************************/
+
+#include <stdio.h>
+#include <linux/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef I2C_RDWR_IOCTL_MAX_MSGS
+#define I2C_RDWR_IOCTL_MAX_MSGS	42
+#endif
+
+#define MAX_BUSES		64
+#define ADDR_FIRST		0x08	/* 0x00~0x07和0x78~0x7f是保留地址 */
+#define ADDR_LAST		0x77
+#define ADDR_10BIT_LAST		0x3ff
+
+enum strategy {
+	STRATEGY_AUTO,
+	STRATEGY_QUICK,
+	STRATEGY_READ,
+	STRATEGY_IGNORE_NAK,
+	STRATEGY_SMBUS,
+};
+
+static const char * const strategy_name[] = {
+	[STRATEGY_AUTO]		= "auto",
+	[STRATEGY_QUICK]	= "quick",
+	[STRATEGY_READ]		= "read",
+	[STRATEGY_IGNORE_NAK]	= "ignore_nak",
+	[STRATEGY_SMBUS]	= "smbus",
+};
+
+struct scan_bus {
+	unsigned int nr;
+	int fd;
+	pthread_t thread;
+	unsigned long funcs;
+	enum strategy strategy;
+	int partial;		/* 适配器是否返回已完成的消息数：-1未知，0否，1是 */
+	unsigned char found[(ADDR_10BIT_LAST + 1) / 8];
+	unsigned char found10[(ADDR_10BIT_LAST + 1) / 8];
+	unsigned long ioctls;
+	long time_us;
+	const char *error;
+};
+
+static struct scan_bus buses[MAX_BUSES];
+static unsigned int nr_buses;
+static enum strategy want_strategy = STRATEGY_AUTO;
+static int scan_10bit;
+static int allow_fast;
+static int json;
+
+static void mark(unsigned char *map, unsigned int addr)
+{
+	map[addr / 8] |= 1 << (addr % 8);
+}
+
+static int marked(const unsigned char *map, unsigned int addr)
+{
+	return map[addr / 8] & (1 << (addr % 8));
+}
+
+static int probe_by_read(const struct scan_bus *b, unsigned int addr, int ten)
+{
+	if (b->strategy == STRATEGY_READ)
+		return 1;
+
+	return !ten && ((addr >= 0x30 && addr <= 0x37) || (addr >= 0x50 && addr <= 0x5f));
+}
+
+/* 用I2C_RDWR打包探测[first, last]，每条消息探测一个地址 */
+static void scan_rdwr(struct scan_bus *b, unsigned int first, unsigned int last,
+		      int ten, unsigned char *map)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	unsigned char bufs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct i2c_rdwr_ioctl_data rdwr;
+	unsigned int addr = first, n, i;
+	int ret;
+
+	while (addr <= last) {
+		n = b->partial == 0 ? 1 : last - addr + 1;
+		if (n > I2C_RDWR_IOCTL_MAX_MSGS)
+			n = I2C_RDWR_IOCTL_MAX_MSGS;
+
+		for (i = 0; i < n; i++) {
+			msgs[i].addr = addr + i;
+			msgs[i].flags = ten ? I2C_M_TEN : 0;
+			msgs[i].len = 0;
+			msgs[i].buf = &bufs[i];
+			if (probe_by_read(b, addr + i, ten)) {
+				msgs[i].flags |= I2C_M_RD;
+				msgs[i].len = 1;
+			}
+		}
+
+		rdwr.msgs = msgs;
+		rdwr.nmsgs = n;
+		b->ioctls++;
+		ret = ioctl(b->fd, I2C_RDWR, &rdwr);
+
+		if (ret == (int)n) {
+			/* 全部应答 */
+			for (i = 0; i < n; i++)
+				mark(map, addr + i);
+			addr += n;
+		} else if (ret >= 0) {
+			/* 前ret个应答，第ret个不应答 */
+			b->partial = 1;
+			for (i = 0; i < (unsigned int)ret; i++)
+				mark(map, addr + i);
+			addr += ret + 1;
+		} else if (n == 1) {
+			if (errno != ENXIO && errno != EREMOTEIO && errno != EIO &&
+			    errno != ETIMEDOUT && errno != EAGAIN) {
+				b->error = strerror(errno);
+				return;
+			}
+			addr++;
+		} else {
+			/* 不知道是哪个地址不应答，只能逐个探测 */
+			b->partial = 0;
+		}
+	}
+}
+
+/* 每次ioctl探测I2C_RDWR_IOCTL_MAX_MSGS个地址，读到0xff的视为不存在 */
+static void scan_ignore_nak(struct scan_bus *b, unsigned int first,
+			    unsigned int last, int ten, unsigned char *map)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	unsigned char bufs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct i2c_rdwr_ioctl_data rdwr;
+	unsigned int addr, n, i;
+
+	for (addr = first; addr <= last; addr += n) {
+		n = last - addr + 1;
+		if (n > I2C_RDWR_IOCTL_MAX_MSGS)
+			n = I2C_RDWR_IOCTL_MAX_MSGS;
+
+		for (i = 0; i < n; i++) {
+			msgs[i].addr = addr + i;
+			msgs[i].flags = I2C_M_RD | I2C_M_IGNORE_NAK | (ten ? I2C_M_TEN : 0);
+			msgs[i].len = 1;
+			msgs[i].buf = &bufs[i];
+			bufs[i] = 0xff;
+		}
+
+		rdwr.msgs = msgs;
+		rdwr.nmsgs = n;
+		b->ioctls++;
+		if (ioctl(b->fd, I2C_RDWR, &rdwr) < 0) {
+			b->error = strerror(errno);
+			return;
+		}
+		for (i = 0; i < n; i++)
+			if (bufs[i] != 0xff)
+				mark(map, addr + i);
+	}
+}
+
+/* 不支持i2c消息的纯SMBus适配器，只能逐个地址I2C_SLAVE+I2C_SMBUS */
+static void scan_smbus(struct scan_bus *b, unsigned int first, unsigned int last,
+		       unsigned char *map)
+{
+	struct i2c_smbus_ioctl_data args;
+	union i2c_smbus_data data;
+	unsigned int addr;
+	int quick = b->funcs & I2C_FUNC_SMBUS_QUICK;
+
+	for (addr = first; addr <= last; addr++) {
+		/* 已经被内核驱动占用的地址一定有设备 */
+		b->ioctls++;
+		if (ioctl(b->fd, I2C_SLAVE, addr) < 0) {
+			if (errno == EBUSY)
+				mark(map, addr);
+			continue;
+		}
+
+		if (quick && !((addr >= 0x30 && addr <= 0x37) || (addr >= 0x50 && addr <= 0x5f))) {
+			args.read_write = I2C_SMBUS_WRITE;
+			args.size = I2C_SMBUS_QUICK;
+		} else {
+			args.read_write = I2C_SMBUS_READ;
+			args.size = I2C_SMBUS_BYTE;
+		}
+		args.command = 0;
+		args.data = &data;
+		b->ioctls++;
+		if (ioctl(b->fd, I2C_SMBUS, &args) == 0)
+			mark(map, addr);
+	}
+}
+
+static enum strategy pick_strategy(const struct scan_bus *b)
+{
+	if (want_strategy != STRATEGY_AUTO)
+		return want_strategy;
+
+	if (allow_fast && (b->funcs & I2C_FUNC_PROTOCOL_MANGLING))
+		return STRATEGY_IGNORE_NAK;
+	if (b->funcs & I2C_FUNC_I2C)
+		return STRATEGY_QUICK;
+
+	return STRATEGY_SMBUS;
+}
+
+static void *scan_thread(void *arg)
+{
+	struct scan_bus *b = arg;
+	struct timespec t0, t1;
+	char path[32];
+
+	snprintf(path, sizeof(path), "/dev/i2c-%u", b->nr);
+	b->fd = open(path, O_RDWR);
+	if (b->fd < 0) {
+		b->error = strerror(errno);
+		return NULL;
+	}
+	if (ioctl(b->fd, I2C_FUNCS, &b->funcs) < 0) {
+		b->error = strerror(errno);
+		close(b->fd);
+		return NULL;
+	}
+	ioctl(b->fd, I2C_RETRIES, 0); /* 不应答就是没有设备，不需要重试 */
+
+	b->strategy = pick_strategy(b);
+	b->partial = -1;
+	if ((b->strategy != STRATEGY_SMBUS && !(b->funcs & I2C_FUNC_I2C)) ||
+	    (b->strategy == STRATEGY_IGNORE_NAK && !(b->funcs & I2C_FUNC_PROTOCOL_MANGLING))) {
+		b->error = "strategy not supported by adapter";
+		close(b->fd);
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	switch (b->strategy) {
+	case STRATEGY_IGNORE_NAK:
+		scan_ignore_nak(b, ADDR_FIRST, ADDR_LAST, 0, b->found);
+		if (scan_10bit && (b->funcs & I2C_FUNC_10BIT_ADDR))
+			scan_ignore_nak(b, 0, ADDR_10BIT_LAST, 1, b->found10);
+		break;
+	case STRATEGY_SMBUS:
+		scan_smbus(b, ADDR_FIRST, ADDR_LAST, b->found);
+		break;
+	default:
+		scan_rdwr(b, ADDR_FIRST, ADDR_LAST, 0, b->found);
+		if (scan_10bit && (b->funcs & I2C_FUNC_10BIT_ADDR))
+			scan_rdwr(b, 0, ADDR_10BIT_LAST, 1, b->found10);
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	b->time_us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+
+	close(b->fd);
+	return NULL;
+}
+
+static void add_bus(unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_buses; i++)
+		if (buses[i].nr == nr)
+			return;
+	if (nr_buses < MAX_BUSES)
+		buses[nr_buses++].nr = nr;
+}
+
+static void find_buses(void)
+{
+	struct dirent *de;
+	unsigned int nr;
+	DIR *dir;
+
+	dir = opendir("/dev");
+	if (!dir)
+		return;
+	while ((de = readdir(dir)))
+		if (sscanf(de->d_name, "i2c-%u", &nr) == 1)
+			add_bus(nr);
+	closedir(dir);
+}
+
+static void print_bus(const struct scan_bus *b)
+{
+	unsigned int addr;
+	int first = 1;
+
+	if (json) {
+		printf("{\"bus\":%u,\"strategy\":\"%s\",\"ioctls\":%lu,\"time_us\":%ld",
+		       b->nr, strategy_name[b->strategy], b->ioctls, b->time_us);
+		if (b->error)
+			printf(",\"error\":\"%s\"", b->error);
+		printf(",\"devices\":[");
+		for (addr = 0; addr <= ADDR_LAST; addr++) {
+			if (!marked(b->found, addr))
+				continue;
+			printf("%s\"0x%02x\"", first ? "" : ",", addr);
+			first = 0;
+		}
+		for (addr = 0; addr <= ADDR_10BIT_LAST; addr++) {
+			if (!marked(b->found10, addr))
+				continue;
+			printf("%s\"0x%03x/10\"", first ? "" : ",", addr);
+			first = 0;
+		}
+		printf("]}\n");
+		return;
+	}
+
+	for (addr = 0; addr <= ADDR_LAST; addr++)
+		if (marked(b->found, addr))
+			printf("%u,0x%02x,%s\n", b->nr, addr, strategy_name[b->strategy]);
+	for (addr = 0; addr <= ADDR_10BIT_LAST; addr++)
+		if (marked(b->found10, addr))
+			printf("%u,0x%03x/10,%s\n", b->nr, addr, strategy_name[b->strategy]);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i, nr;
+	char *tok;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:s:tFj")) != -1) {
+		switch (opt) {
+		case 'b':
+			for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ","))
+				if (sscanf(tok, "%u", &nr) == 1)
+					add_bus(nr);
+			break;
+		case 's':
+			for (i = 0; i < sizeof(strategy_name) / sizeof(strategy_name[0]); i++)
+				if (!strcmp(optarg, strategy_name[i]))
+					break;
+			if (i == sizeof(strategy_name) / sizeof(strategy_name[0])) {
+				printf("Unknown strategy: %s\n", optarg);
+				return 1;
+			}
+			want_strategy = i;
+			break;
+		case 't':
+			scan_10bit = 1;
+			break;
+		case 'F':
+			allow_fast = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		default:
+			printf("Use:\n%s [-b bus,...] [-s auto|quick|read|ignore_nak|smbus] [-t] [-F] [-j]\n",
+			       argv[0]);
+			return 0;
+		}
+	}
+
+	if (!nr_buses)
+		find_buses();
+	if (!nr_buses) {
+		printf("No i2c buses found\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_buses; i++)
+		pthread_create(&buses[i].thread, NULL, scan_thread, &buses[i]);
+	for (i = 0; i < nr_buses; i++)
+		pthread_join(buses[i].thread, NULL);
+
+	if (!json)
+		printf("bus,addr,strategy\n");
+	for (i = 0; i < nr_buses; i++) {
+		print_bus(&buses[i]);
+		if (buses[i].error)
+			fprintf(stderr, "i2c-%u: %s\n", buses[i].nr, buses[i].error);
+		else
+			fprintf(stderr, "i2c-%u: strategy:%s ioctls:%lu time:%ldus\n", buses[i].nr,
+				strategy_name[buses[i].strategy], buses[i].ioctls, buses[i].time_us);
+	}
+
+	return 0;
+}
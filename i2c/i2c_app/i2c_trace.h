@@ -0,0 +1,117 @@
+/********************** 说明 ***************************
+ * i2c传输捕获文件的格式，与i2c_host.c中xxx_i2c的debugfs trace文件、
+ * i2c_sim/i2c_trace.c（LD_PRELOAD方式捕获i2c_app工具的ioctl/read/write）
+ * 的输出相同，由i2c_replay回放。
+ *
+ * 文件由一个struct i2c_trace_file_hdr开头，之后是一个个传输记录：
+ *   struct i2c_trace_xfer
+ *   nmsgs个 { struct i2c_trace_msg, data_len字节数据 }
+ * 没有任何填充，所有字段都是本机字节序。每条消息只记录前
+ * payload字节数据（文件头中给出），data_len < len时回放的写消息
+ * 不足的部分补0。记录不一定按时间排序（内核按CPU分别输出），
+ * 读者需要时按timestamp排序。
+******************************************************/
+
+#ifndef I2C_TRACE_H
+#define I2C_TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <linux/i2c.h>
+
+#define I2C_TRACE_MAGIC		0x54433249	/* "I2CT" */
+#define I2C_TRACE_VERSION	1
+
+struct i2c_trace_file_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t payload;	/* 每条消息最多记录的数据字节数 */
+};
+
+struct i2c_trace_xfer {
+	uint64_t timestamp;	/* 传输开始的时间，CLOCK_MONOTONIC，ns */
+	uint32_t duration;	/* ns */
+	int16_t result;		/* 完成的消息数或负的错误码 */
+	uint8_t nmsgs;
+	uint8_t bus;
+};
+
+struct i2c_trace_msg {
+	uint16_t addr;
+	uint16_t flags;
+	uint16_t len;
+	uint16_t data_len;	/* 记录下来的数据字节数，不超过len */
+};
+
+/* 编码后的记录长度 */
+static inline size_t i2c_trace_size(const struct i2c_msg *msgs, unsigned int n,
+				    unsigned int payload)
+{
+	size_t size = sizeof(struct i2c_trace_xfer);
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		size += sizeof(struct i2c_trace_msg) +
+			(msgs[i].len < payload ? msgs[i].len : payload);
+
+	return size;
+}
+
+/* 把一次传输编码到buf，buf至少要有i2c_trace_size()字节，返回写入的字节数 */
+static inline size_t i2c_trace_encode(unsigned char *buf, const struct i2c_msg *msgs,
+				      unsigned int n, int result, uint64_t timestamp,
+				      uint64_t duration, unsigned int bus,
+				      unsigned int payload)
+{
+	struct i2c_trace_xfer x;
+	struct i2c_trace_msg m;
+	size_t pos = 0;
+	unsigned int i;
+
+	x.timestamp = timestamp;
+	x.duration = duration > UINT32_MAX ? UINT32_MAX : duration;
+	x.result = result;
+	x.nmsgs = n;
+	x.bus = bus;
+	memcpy(buf, &x, sizeof(x));
+	pos += sizeof(x);
+
+	for (i = 0; i < n; i++) {
+		m.addr = msgs[i].addr;
+		m.flags = msgs[i].flags;
+		m.len = msgs[i].len;
+		m.data_len = msgs[i].len < payload ? msgs[i].len : payload;
+		memcpy(buf + pos, &m, sizeof(m));
+		pos += sizeof(m);
+		memcpy(buf + pos, msgs[i].buf, m.data_len);
+		pos += m.data_len;
+	}
+
+	return pos;
+}
+
+/* 检查buf中从pos开始是否有一条完整的记录，返回它的长度，不完整时返回0 */
+static inline size_t i2c_trace_next(const unsigned char *buf, size_t size, size_t pos)
+{
+	struct i2c_trace_xfer x;
+	struct i2c_trace_msg m;
+	size_t len = sizeof(x);
+	unsigned int i;
+
+	if (size - pos < sizeof(x))
+		return 0;
+	memcpy(&x, buf + pos, sizeof(x));
+
+	for (i = 0; i < x.nmsgs; i++) {
+		if (size - pos - len < sizeof(m))
+			return 0;
+		memcpy(&m, buf + pos + len, sizeof(m));
+		len += sizeof(m) + m.data_len;
+		if (len > size - pos || m.data_len > m.len)
+			return 0;
+	}
+
+	return len;
+}
+
+#endif /* I2C_TRACE_H */
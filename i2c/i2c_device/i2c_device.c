@@ -182,34 +182,1055 @@ struct i2c_client * i2c_new_probed_device(struct i2c_adapter *adap,struct i2c_bo
 
 /**********************驱动模板***************************/
 
+/* RAM影子缓存：EEPROM内容几乎不变，读过的页保存在内存中，之后的读直接
+ * 从内存返回而不再访问总线；写穿透到芯片后同步更新影子；也可以通过
+ * sysfs的shadow_invalidate手工作废。
+ * XXX_SHADOW_OFF:  不使用影子，每次读都访问总线
+ * XXX_SHADOW_PAGE: 按页懒加载，只读入本次访问到的页
+ * XXX_SHADOW_FULL: 第一次访问时读入整个芯片 */
+enum {
+	XXX_SHADOW_OFF,
+	XXX_SHADOW_PAGE,
+	XXX_SHADOW_FULL,
+};
+
+#define XXX_SHADOW_PAGE_SIZE	64	/* 懒加载的粒度 */
+
+/* 位于mmap映射的最后一页，用于检测影子被更新 */
+struct xxx_mmap_status {
+	__u32 seq;		/* 奇数表示正在更新 */
+	__u32 byte_len;
+};
+
+static unsigned int shadow_mode = XXX_SHADOW_PAGE;
+module_param(shadow_mode, uint, 0444);
+MODULE_PARM_DESC(shadow_mode, "EEPROM shadow cache: 0=off, 1=per page, 2=full chip");
+
+/* 驱动使用异步probe，不同适配器上的设备可以并行probe；probe中只做
+ * 必要的初始化，然后在工作队列中后台把整个芯片预读进影子。
+ * 预读按块进行，每块之间释放xxx->lock，读者不必等整个芯片读完，
+ * 最多等当前这一块，然后自己加载还缺的页。 */
+#define XXX_PREFETCH_CHUNK	256
+
+static bool prefetch = true;
+module_param(prefetch, bool, 0444);
+MODULE_PARM_DESC(prefetch, "Read the whole EEPROM into the shadow in the background after probe");
+
+/* 寄存器型设备（如板级信息中带irq的ak8975/adxl34x）的数据寄存器组 */
+#define XXX_DATA_REG		0x00
+#define XXX_SAMPLE_LEN		6
+#define XXX_SAMPLE_FIFO_SIZE	512	/* 样本个数，必须是2的幂 */
+
+/* read()返回给用户的样本格式 */
+struct xxx_sample {
+	__s64 timestamp;	/* 数据就绪中断的时间，CLOCK_BOOTTIME，单位ns */
+	__u8 data[XXX_SAMPLE_LEN];
+	__u8 pad[2];		/* 显式填充到8字节对齐，总为0 */
+};
+
+/* 寄存器型设备通过regmap访问：配置寄存器读的远比写的多，由regmap缓存，
+ * 只有易失寄存器（状态、数据）才访问总线；读会改变芯片状态的寄存器
+ * （读清除的中断状态、FIFO数据）标为precious，缓存和sysfs转储都不会读它们。
+ * 每种芯片在xxx_regs_chips中描述寄存器表，按i2c_device_id的名字匹配 */
+#define XXX_REGS_MAX		256
+
+struct xxx_regs_desc {
+	const char *name;
+	unsigned int max_register;
+	const struct regmap_access_table *rd_table;
+	const struct regmap_access_table *wr_table;
+	const struct regmap_access_table *volatile_table;
+	const struct regmap_access_table *precious_table;
+	const struct reg_default *defaults;	/* 数据手册中的复位值 */
+	unsigned int num_defaults;
+};
+
+static const struct regmap_range ak8975_rd_ranges[] = {
+	regmap_reg_range(0x00, 0x0a),	/* WIA ~ CNTL */
+	regmap_reg_range(0x0c, 0x0c),	/* ASTC */
+	regmap_reg_range(0x0f, 0x12),	/* I2CDIS, ASAX ~ ASAZ */
+};
+static const struct regmap_range ak8975_wr_ranges[] = {
+	regmap_reg_range(0x0a, 0x0a),
+	regmap_reg_range(0x0c, 0x0c),
+	regmap_reg_range(0x0f, 0x0f),
+};
+static const struct regmap_range ak8975_volatile_ranges[] = {
+	regmap_reg_range(0x01, 0x09),	/* INFO、ST1、数据、ST2 */
+	regmap_reg_range(0x10, 0x12),	/* 熔丝ROM只在fuse模式下可读 */
+};
+static const struct regmap_range ak8975_precious_ranges[] = {
+	regmap_reg_range(0x09, 0x09),	/* 读ST2结束一次测量的数据保护 */
+};
+static const struct regmap_access_table ak8975_rd_table = {
+	.yes_ranges = ak8975_rd_ranges, .n_yes_ranges = ARRAY_SIZE(ak8975_rd_ranges),
+};
+static const struct regmap_access_table ak8975_wr_table = {
+	.yes_ranges = ak8975_wr_ranges, .n_yes_ranges = ARRAY_SIZE(ak8975_wr_ranges),
+};
+static const struct regmap_access_table ak8975_volatile_table = {
+	.yes_ranges = ak8975_volatile_ranges, .n_yes_ranges = ARRAY_SIZE(ak8975_volatile_ranges),
+};
+static const struct regmap_access_table ak8975_precious_table = {
+	.yes_ranges = ak8975_precious_ranges, .n_yes_ranges = ARRAY_SIZE(ak8975_precious_ranges),
+};
+static const struct reg_default ak8975_defaults[] = {
+	{ 0x00, 0x48 }, { 0x0a, 0x00 }, { 0x0c, 0x00 }, { 0x0f, 0x00 },
+};
+
+static const struct regmap_range adxl34x_rd_ranges[] = {
+	regmap_reg_range(0x00, 0x00),	/* DEVID */
+	regmap_reg_range(0x1d, 0x39),	/* THRESH_TAP ~ FIFO_STATUS */
+};
+static const struct regmap_range adxl34x_wr_ranges[] = {
+	regmap_reg_range(0x1d, 0x2a),
+	regmap_reg_range(0x2c, 0x2f),	/* BW_RATE ~ INT_MAP */
+	regmap_reg_range(0x31, 0x31),	/* DATA_FORMAT */
+	regmap_reg_range(0x38, 0x38),	/* FIFO_CTL */
+};
+static const struct regmap_range adxl34x_volatile_ranges[] = {
+	regmap_reg_range(0x2b, 0x2b),	/* ACT_TAP_STATUS */
+	regmap_reg_range(0x30, 0x30),	/* INT_SOURCE */
+	regmap_reg_range(0x32, 0x37),	/* DATAX0 ~ DATAZ1 */
+	regmap_reg_range(0x39, 0x39),	/* FIFO_STATUS */
+};
+static const struct regmap_range adxl34x_precious_ranges[] = {
+	regmap_reg_range(0x30, 0x30),	/* 读清除活动/敲击中断 */
+	regmap_reg_range(0x32, 0x37),	/* 读数据会从FIFO中取走一个样本 */
+};
+static const struct regmap_access_table adxl34x_rd_table = {
+	.yes_ranges = adxl34x_rd_ranges, .n_yes_ranges = ARRAY_SIZE(adxl34x_rd_ranges),
+};
+static const struct regmap_access_table adxl34x_wr_table = {
+	.yes_ranges = adxl34x_wr_ranges, .n_yes_ranges = ARRAY_SIZE(adxl34x_wr_ranges),
+};
+static const struct regmap_access_table adxl34x_volatile_table = {
+	.yes_ranges = adxl34x_volatile_ranges, .n_yes_ranges = ARRAY_SIZE(adxl34x_volatile_ranges),
+};
+static const struct regmap_access_table adxl34x_precious_table = {
+	.yes_ranges = adxl34x_precious_ranges, .n_yes_ranges = ARRAY_SIZE(adxl34x_precious_ranges),
+};
+static const struct reg_default adxl34x_defaults[] = {
+	{ 0x00, 0xe5 },
+	{ 0x1d, 0x00 }, { 0x1e, 0x00 }, { 0x1f, 0x00 }, { 0x20, 0x00 },
+	{ 0x21, 0x00 }, { 0x22, 0x00 }, { 0x23, 0x00 }, { 0x24, 0x00 },
+	{ 0x25, 0x00 }, { 0x26, 0x00 }, { 0x27, 0x00 }, { 0x28, 0x00 },
+	{ 0x29, 0x00 }, { 0x2a, 0x00 },
+	{ 0x2c, 0x0a }, { 0x2d, 0x00 }, { 0x2e, 0x00 }, { 0x2f, 0x00 },
+	{ 0x31, 0x00 }, { 0x38, 0x00 },
+};
+
+static const struct xxx_regs_desc xxx_regs_chips[] = {
+	{
+		.name = "ak8975",
+		.max_register = 0x12,
+		.rd_table = &ak8975_rd_table,
+		.wr_table = &ak8975_wr_table,
+		.volatile_table = &ak8975_volatile_table,
+		.precious_table = &ak8975_precious_table,
+		.defaults = ak8975_defaults,
+		.num_defaults = ARRAY_SIZE(ak8975_defaults),
+	},
+	{
+		.name = "adxl34x",
+		.max_register = 0x39,
+		.rd_table = &adxl34x_rd_table,
+		.wr_table = &adxl34x_wr_table,
+		.volatile_table = &adxl34x_volatile_table,
+		.precious_table = &adxl34x_precious_table,
+		.defaults = adxl34x_defaults,
+		.num_defaults = ARRAY_SIZE(adxl34x_defaults),
+	},
+};
+
+/* 0=不缓存，1=flat（按寄存器号直接索引的数组），2=rbtree（按连续块组织，
+ * 同步时每块一次批量写） */
+static unsigned int regcache = 2;
+module_param(regcache, uint, 0444);
+MODULE_PARM_DESC(regcache, "Register cache for register-style devices: 0=none, 1=flat, 2=rbtree");
+
+/* 一次i2c_transfer中最多拼接的“写地址+读数据”消息对数 */
+#define XXX_MAX_XFER_PAIRS	4
+
+/* 没有影子缓存时，并发的读请求在总线忙时排队，由当前占用总线的读者
+ * 一次取走全部排队的请求，按偏移排序后把重叠、相邻或间隔不超过
+ * coalesce_gap字节的请求合并成一次连续读（多读几个字节比多一次地址
+ * 阶段便宜），再从合并读的结果中分别拷给每个等待者。
+ * coalesce=0时每个读者单独读，用于对比 */
+struct xxx_read_req {
+	struct list_head node;
+	loff_t off;
+	size_t count;
+	char *buf;
+	ssize_t status;
+	bool leader;		/* 被唤醒后由它来处理下一批 */
+	struct completion done;
+};
+
+static bool coalesce = true;
+module_param(coalesce, bool, 0644);
+MODULE_PARM_DESC(coalesce, "Merge concurrent reads into shared burst transfers");
+
+static unsigned int coalesce_gap = 8;
+module_param(coalesce_gap, uint, 0644);
+MODULE_PARM_DESC(coalesce_gap, "Max hole (in bytes) read through when merging two reads");
+
+/* 写操作按页进行，每页写完后ACK轮询，直到芯片结束内部写周期。
+ * ack_poll=0时退回到每页固定睡眠write_timeout毫秒，用于对比 */
+#define XXX_ACK_POLL_US		100
+
+static unsigned int write_timeout = 25;
+module_param(write_timeout, uint, 0644);
+MODULE_PARM_DESC(write_timeout, "Time (in ms) to try writes (default 25)");
+
+static bool ack_poll = true;
+module_param(ack_poll, bool, 0644);
+MODULE_PARM_DESC(ack_poll, "Poll for write completion instead of sleeping write_timeout");
+
+/* 每个设备的传输统计，CONFIG_EEPROM_XXX_STATS关闭时统计函数都是空的
+ * 内联函数。计数器是per-CPU的，热路径上只加本CPU的副本，不需要锁，
+ * 在/sys/kernel/debug/xxx/<设备名>/下查看和清零。 */
+enum xxx_stat {
+	XXX_STAT_READS,		/* 读传输（一次i2c_transfer）次数 */
+	XXX_STAT_READ_BYTES,
+	XXX_STAT_WRITES,	/* 页写次数 */
+	XXX_STAT_WRITE_BYTES,
+	XXX_STAT_NAKS,
+	XXX_STAT_TIMEOUTS,	/* 总线超时及ACK轮询超时 */
+	XXX_STAT_RETRIES,	/* 写周期内未应答的ACK轮询次数 */
+	XXX_STAT_ERRORS,	/* 其他错误 */
+	XXX_STAT_NR
+};
+
+/* 延迟直方图按读/写方向及一次传输的数据长度分组 */
+enum {
+	XXX_SIZE_SMALL,		/* 1~16字节 */
+	XXX_SIZE_MEDIUM,	/* 17~255字节 */
+	XXX_SIZE_LARGE,		/* 256字节以上 */
+	XXX_SIZE_NR
+};
+
+/* 第0个桶是不到1us，第i个桶是[2^(i-1), 2^i)us，最后一个桶不封顶 */
+#define XXX_STAT_LAT_BUCKETS	20
+
+#if IS_ENABLED(CONFIG_EEPROM_XXX_STATS)
+struct xxx_stats {
+	u64 cnt[XXX_STAT_NR];
+	u64 lat[2][XXX_SIZE_NR][XXX_STAT_LAT_BUCKETS];	/* [0]读 [1]写 */
+};
+
+static struct dentry *xxx_debugfs_root;
+#endif
+
 struct xxx_data {
 	struct xxx_platform_data chip;
+	struct i2c_client *client;
+	struct mutex lock;	/* 串行化对芯片和影子缓存的访问 */
 	...
 	struct bin_attribute bin;
+
+	/* 由适配器的i2c_adapter_quirks算出的单次传输上限，probe时确定 */
+	unsigned int max_pairs;		/* 每次i2c_transfer的消息对数 */
+	size_t max_read_len;		/* 每条读消息的最大长度 */
+	unsigned int write_max;		/* 每次页写的最大长度 */
+	u8 *writebuf;			/* 地址+一页数据 */
+
+	unsigned long write_bytes;	/* 写统计，供write_stats查看 */
+	unsigned long write_pages;
+	unsigned long write_polls;
+	u64 write_time_ns;
+
+	u8 *shadow;			/* chip.byte_len字节的影子，为NULL表示不使用，
+					 * 用vmalloc_user()分配以便映射到用户空间 */
+	struct xxx_mmap_status *mmap_status;	/* 影子之后的一页 */
+	bool mapped;			/* 曾被mmap，作废时需要立即重新加载 */
+	struct miscdevice miscdev;
+	char miscname[32];
+	struct work_struct prefetch_work;
+
+	DECLARE_KFIFO_PTR(samples, struct xxx_sample);	/* 中断采集的样本 */
+	struct mutex sample_read_lock;	/* 串行化多个读者 */
+	wait_queue_head_t sample_wait;
+	unsigned int sample_watermark;	/* FIFO中达到这么多样本才唤醒读者 */
+	unsigned long samples_dropped;	/* FIFO满时丢弃的样本数 */
+	s64 irq_timestamp;
+	struct miscdevice sample_miscdev;
+	char sample_miscname[32];
+	/* 两个字符设备上打开的fd可能比设备绑定活得久：probe（经devm动作）
+	 * 和每个fd各持有一个引用，最后一个引用放掉时才释放影子、FIFO和本结构。
+	 * fd上的操作持有remove_sem的读锁并检查removed，remove之后返回-ENODEV */
+	struct kref ref;
+	struct rw_semaphore remove_sem;
+	bool removed;
+	ktime_t probe_start;		/* 用于统计probe到数据就绪的时间 */
+	unsigned long *shadow_valid;	/* 每个XXX_SHADOW_PAGE_SIZE一位，置位表示已加载 */
+	unsigned long shadow_hits;	/* 完全由影子服务的读次数 */
+	unsigned long shadow_misses;	/* 需要访问总线的读次数 */
+	spinlock_t rq_lock;		/* 保护rq_pending和rq_busy */
+	struct list_head rq_pending;	/* 等待合并读的请求 */
+	bool rq_busy;			/* 有读者正在处理一批请求 */
+	u32 bus_freq;			/* 总线频率，用于估算节省的总线时间 */
+	unsigned long rq_requests;	/* 合并读统计，由xxx->lock保护 */
+	unsigned long rq_batches;
+	unsigned long rq_extents;	/* 实际发出的连续读次数 */
+	u64 rq_bytes_requested;
+	u64 rq_bytes_read;
+
+	struct regmap *regmap;		/* 寄存器型设备才有，为NULL表示按EEPROM访问 */
+	const struct xxx_regs_desc *regs;
+	struct mutex regs_lock;		/* 串行化写寄存器、批量提交和同步 */
+	bool regs_batching;		/* 写只进缓存，提交时批量写出 */
+	DECLARE_BITMAP(regs_dirty, XXX_REGS_MAX);	/* 批量期间写过的寄存器 */
+	unsigned long reg_writes;	/* 寄存器统计，供reg_stats查看 */
+	unsigned long reg_flushes;	/* 提交时发出的批量写次数 */
+	unsigned long reg_flush_bytes;
+	unsigned long reg_syncs;
+#if IS_ENABLED(CONFIG_EEPROM_XXX_STATS)
+	struct xxx_stats __percpu *stats;
+	struct dentry *debugfs;
+#endif
 	...
+
+	/* 占用多个从地址的芯片（如XXX_FLAG_TAKE8ADDR），每个地址对应一个client，
+	 * clients[0]就是上面的client */
+	unsigned int num_addresses;
+	struct i2c_client *clients[];
 };
 
 static const struct i2c_device_id xxx_ids[] = {
 	{"xxx", XXX_DEVICE_MAGIC(128 / 8, XXX_FLAG_TAKE8ADDR)},
+	/* 寄存器型设备，寄存器表见xxx_regs_chips */
+	{"ak8975", XXX_DEVICE_MAGIC(256, 0)},
+	{"adxl34x", XXX_DEVICE_MAGIC(256, 0)},
 	{}
 };
 MODULE_DEVICE_TABLE(i2c, xxx_ids);
 
-staitc ssize_t xxx_eeprom_read(struct xxx_data *xxx, char *buf,
+#if IS_ENABLED(CONFIG_EEPROM_XXX_STATS)
+static inline void xxx_stat_inc(struct xxx_data *xxx, enum xxx_stat id)
+{
+	this_cpu_inc(xxx->stats->cnt[id]);
+}
+
+/* 传输开始时调用，返回值交给xxx_stat_xfer() */
+static inline ktime_t xxx_stat_start(void)
+{
+	return ktime_get();
+}
+
+/* 一次读或写传输结束时调用，status为i2c_transfer()的返回值 */
+static void xxx_stat_xfer(struct xxx_data *xxx, bool write, size_t len,
+			  int status, ktime_t start)
+{
+	u64 us = ktime_us_delta(ktime_get(), start);
+	int size, bucket;
+
+	if (status < 0) {
+		if (status == -ENXIO || status == -ECONNREFUSED || status == -EREMOTEIO)
+			xxx_stat_inc(xxx, XXX_STAT_NAKS);
+		else if (status == -ETIMEDOUT)
+			xxx_stat_inc(xxx, XXX_STAT_TIMEOUTS);
+		else
+			xxx_stat_inc(xxx, XXX_STAT_ERRORS);
+		return;
+	}
+
+	size = len <= 16 ? XXX_SIZE_SMALL : len < 256 ? XXX_SIZE_MEDIUM : XXX_SIZE_LARGE;
+	bucket = us ? min_t(int, ilog2(us) + 1, XXX_STAT_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(xxx->stats->cnt[write ? XXX_STAT_WRITES : XXX_STAT_READS]);
+	this_cpu_add(xxx->stats->cnt[write ? XXX_STAT_WRITE_BYTES : XXX_STAT_READ_BYTES],
+		     len);
+	this_cpu_inc(xxx->stats->lat[write][size][bucket]);
+}
+#else
+static inline void xxx_stat_inc(struct xxx_data *xxx, enum xxx_stat id) {}
+static inline ktime_t xxx_stat_start(void)
+{
+	return 0;
+}
+static inline void xxx_stat_xfer(struct xxx_data *xxx, bool write, size_t len,
+				 int status, ktime_t start) {}
+#endif
+
+/* 把芯片内的偏移转换成对应的从地址client和该地址内的偏移 */
+static struct i2c_client *xxx_translate_offset(struct xxx_data *xxx,
+					unsigned *offset)
+{
+	unsigned i;
+
+	if (xxx->chip.flags & XXX_FLAG_ADDR16) {
+		i = *offset >> 16;
+		*offset &= 0xffff;
+	} else {
+		i = *offset >> 8;
+		*offset &= 0xff;
+	}
+
+	return xxx->clients[i];
+}
+
+/* 根据适配器的quirks算出每次传输能拼几组消息、每条读消息最多多长 */
+static void xxx_init_xfer_limits(struct xxx_data *xxx)
+{
+	const struct i2c_adapter_quirks *q = xxx->client->adapter->quirks;
+
+	xxx->max_pairs = XXX_MAX_XFER_PAIRS;
+	xxx->max_read_len = U16_MAX; /* i2c_msg.len是16位的 */
+	if (!q)
+		return;
+
+	if (q->max_read_len)
+		xxx->max_read_len = min_t(size_t, xxx->max_read_len, q->max_read_len);
+
+	if (q->flags & I2C_AQ_COMB_WRITE_THEN_READ) {
+		/* 只支持“写+读”两条消息的组合传输 */
+		xxx->max_pairs = 1;
+		if (q->max_comb_2nd_msg_len)
+			xxx->max_read_len = min_t(size_t, xxx->max_read_len,
+						  q->max_comb_2nd_msg_len);
+	} else if (q->max_num_msgs) {
+		xxx->max_pairs = clamp_t(unsigned int, q->max_num_msgs / 2,
+					 1, XXX_MAX_XFER_PAIRS);
+	}
+}
+
+/* 读一次最多能读多少：不能超过适配器的限制，也不能越过当前从地址的边界，
+ * 越界的部分由下一组消息从下一个从地址读 */
+static size_t xxx_adjust_read_count(struct xxx_data *xxx,
 					unsigned offset, size_t count)
 {
-	struct i2c_msg msg[2];
-	...
-	i2c_transfer(client->adapter, msg, 2);
-	...
+	size_t remainder;
+
+	remainder = (xxx->chip.flags & XXX_FLAG_ADDR16 ? BIT(16) : BIT(8)) - offset;
+	if (count > remainder)
+		count = remainder;
+	if (count > xxx->max_read_len)
+		count = xxx->max_read_len;
+
+	return count;
+}
+
+/* 一次i2c_transfer中拼接尽可能多的“写地址+读数据”消息对，
+ * 返回本次读到的字节数，可能小于count，由调用者继续读剩下的部分 */
+static ssize_t xxx_eeprom_read(struct xxx_data *xxx, char *buf,
+					unsigned offset, size_t count)
+{
+	struct i2c_msg msg[XXX_MAX_XFER_PAIRS * 2];
+	u8 msgbuf[XXX_MAX_XFER_PAIRS][2];
+	struct i2c_client *client;
+	unsigned int n, i, off;
+	size_t len, done = 0;
+	ktime_t start;
+	int status;
+
+	memset(msg, 0, sizeof(msg));
+	for (n = 0; n < xxx->max_pairs && done < count; n++) {
+		off = offset + done;
+		client = xxx_translate_offset(xxx, &off);
+		len = xxx_adjust_read_count(xxx, off, count - done);
+
+		i = 0;
+		if (xxx->chip.flags & XXX_FLAG_ADDR16)
+			msgbuf[n][i++] = off >> 8;
+		msgbuf[n][i++] = off;
+
+		msg[n * 2].addr = client->addr;
+		msg[n * 2].buf = msgbuf[n];
+		msg[n * 2].len = i;
+
+		msg[n * 2 + 1].addr = client->addr;
+		msg[n * 2 + 1].flags = I2C_M_RD;
+		msg[n * 2 + 1].buf = buf + done;
+		msg[n * 2 + 1].len = len;
+
+		done += len;
+	}
+
+	start = xxx_stat_start();
+	status = i2c_transfer(xxx->client->adapter, msg, n * 2);
+	xxx_stat_xfer(xxx, false, done, status, start);
+	dev_dbg(&xxx->client->dev, "read %zu@%d --> %d\n", done, offset, status);
+	if (status == n * 2)
+		return done;
+
+	return status < 0 ? status : -EIO;
+}
+
+/* 写周期内芯片不应答自己的地址。这里只发送存储地址（不带数据，不会
+ * 触发新的写周期）来轮询，一旦应答就说明内部写周期已结束，
+ * 而不是固定睡眠数据手册上的最长写周期 */
+static int xxx_ack_poll(struct xxx_data *xxx, struct i2c_client *client,
+					struct i2c_msg *msg)
+{
+	struct i2c_msg poll = *msg;
+	unsigned long timeout;
+
+	poll.len = xxx->chip.flags & XXX_FLAG_ADDR16 ? 2 : 1;
+	timeout = jiffies + msecs_to_jiffies(write_timeout);
+	do {
+		xxx->write_polls++;
+		if (i2c_transfer(client->adapter, &poll, 1) == 1)
+			return 0;
+		xxx_stat_inc(xxx, XXX_STAT_RETRIES);
+		usleep_range(XXX_ACK_POLL_US, XXX_ACK_POLL_US * 2);
+	} while (time_before(jiffies, timeout));
+
+	/* 超时前可能刚好被调度出去，再试最后一次 */
+	xxx->write_polls++;
+	if (i2c_transfer(client->adapter, &poll, 1) == 1)
+		return 0;
+	xxx_stat_inc(xxx, XXX_STAT_TIMEOUTS);
+
+	return -ETIMEDOUT;
 }
 
-static ssizr_t xxx_read(struct xxx_data *xxx,
+/* 写一页：最多xxx->write_max字节，不跨页，写完等待写周期结束，
+ * 返回本次写入的字节数，可能小于count，由调用者继续写剩下的部分 */
+static ssize_t xxx_eeprom_write(struct xxx_data *xxx, const char *buf,
+					unsigned offset, size_t count)
+{
+	struct i2c_client *client;
+	struct i2c_msg msg;
+	unsigned next_page, off = offset;
+	ktime_t start;
+	int i = 0;
+	int status;
+
+	client = xxx_translate_offset(xxx, &off);
+
+	if (count > xxx->write_max)
+		count = xxx->write_max;
+	/* 页写不能越过页边界，否则芯片会在页内回绕覆盖页首的数据 */
+	next_page = roundup(offset + 1, xxx->chip.page_size);
+	if (offset + count > next_page)
+		count = next_page - offset;
+
+	if (xxx->chip.flags & XXX_FLAG_ADDR16)
+		xxx->writebuf[i++] = off >> 8;
+	xxx->writebuf[i++] = off;
+	memcpy(&xxx->writebuf[i], buf, count);
+
+	msg.addr = client->addr;
+	msg.flags = 0;
+	msg.buf = xxx->writebuf;
+	msg.len = i + count;
+
+	start = xxx_stat_start();
+	status = i2c_transfer(client->adapter, &msg, 1);
+	xxx_stat_xfer(xxx, true, count, status, start);
+	dev_dbg(&client->dev, "write %zu@%d --> %d\n", count, offset, status);
+	if (status != 1)
+		return status < 0 ? status : -EIO;
+	xxx->write_pages++;
+
+	if (ack_poll) {
+		status = xxx_ack_poll(xxx, client, &msg);
+		if (status)
+			return status;
+	} else {
+		msleep(write_timeout);
+	}
+
+	return count;
+}
+
+/* 从芯片读，xxx_eeprom_read()一次可能只读到一部分，调用者持有xxx->lock */
+static ssize_t xxx_read_chip(struct xxx_data *xxx,
 					char *buf, loff_t off, size_t count)
 {
-	...
-	status = xxx_eeprom_read(xxx, buf, off, count);
-	...
+	ssize_t retval = 0;
+
+	while (count) {
+		ssize_t status;
+
+		status = xxx_eeprom_read(xxx, buf, off, count);
+		if (status <= 0) {
+			if (retval == 0)
+				retval = status;
+			break;
+		}
+		buf += status;
+		off += status;
+		count -= status;
+		retval += status;
+	}
+
+	return retval;
+}
+
+static ssize_t xxx_write_chip(struct xxx_data *xxx,
+					const char *buf, loff_t off, size_t count)
+{
+	ssize_t retval = 0;
+
+	while (count) {
+		ssize_t status;
+
+		status = xxx_eeprom_write(xxx, buf, off, count);
+		if (status <= 0) {
+			if (retval == 0)
+				retval = status;
+			break;
+		}
+		buf += status;
+		off += status;
+		count -= status;
+		retval += status;
+	}
+
+	return retval;
+}
+
+/* 影子内容变化前后各调用一次，让mmap的用户察觉到更新 */
+static inline void xxx_shadow_seq_begin(struct xxx_data *xxx)
+{
+	WRITE_ONCE(xxx->mmap_status->seq, xxx->mmap_status->seq + 1);
+	smp_wmb();
+}
+
+static inline void xxx_shadow_seq_end(struct xxx_data *xxx)
+{
+	smp_wmb();
+	WRITE_ONCE(xxx->mmap_status->seq, xxx->mmap_status->seq + 1);
+}
+
+/* 把[off, off + count)中尚未加载的页读入影子，连续缺失的页合并成一次读，
+ * 调用者持有xxx->lock */
+static int xxx_shadow_fill(struct xxx_data *xxx, loff_t off, size_t count)
+{
+	unsigned int first, last, start, end;
+	size_t len;
+	ssize_t status;
+
+	first = off / XXX_SHADOW_PAGE_SIZE;
+	last = DIV_ROUND_UP(off + count, XXX_SHADOW_PAGE_SIZE);
+
+	for (start = find_next_zero_bit(xxx->shadow_valid, last, first);
+	     start < last;
+	     start = find_next_zero_bit(xxx->shadow_valid, last, end)) {
+		end = find_next_bit(xxx->shadow_valid, last, start);
+		len = min_t(size_t, (end - start) * XXX_SHADOW_PAGE_SIZE,
+			    xxx->chip.byte_len - start * XXX_SHADOW_PAGE_SIZE);
+
+		xxx_shadow_seq_begin(xxx);
+		status = xxx_read_chip(xxx, xxx->shadow + start * XXX_SHADOW_PAGE_SIZE,
+				       start * XXX_SHADOW_PAGE_SIZE, len);
+		xxx_shadow_seq_end(xxx);
+		if (status < 0)
+			return status;
+		if (status != len)
+			return -EIO;
+		bitmap_set(xxx->shadow_valid, start, end - start);
+	}
+
+	return 0;
+}
+
+/* 写穿透后同步影子，未加载的页不置有效位，下次读时再从芯片加载 */
+static void xxx_shadow_update(struct xxx_data *xxx, const char *buf,
+					loff_t off, size_t count)
+{
+	if (!xxx->shadow || !count)
+		return;
+
+	xxx_shadow_seq_begin(xxx);
+	memcpy(xxx->shadow + off, buf, count);
+	xxx_shadow_seq_end(xxx);
+}
+
+static void xxx_shadow_invalidate(struct xxx_data *xxx)
+{
+	unsigned int npages = DIV_ROUND_UP(xxx->chip.byte_len, XXX_SHADOW_PAGE_SIZE);
+
+	mutex_lock(&xxx->lock);
+	if (xxx->shadow) {
+		bitmap_zero(xxx->shadow_valid, npages);
+		/* 映射的用户不会再进入内核，只能立刻重新加载 */
+		if (xxx->mapped && xxx_shadow_fill(xxx, 0, xxx->chip.byte_len))
+			dev_warn(&xxx->client->dev, "failed to refresh shadow\n");
+	}
+	mutex_unlock(&xxx->lock);
+}
+
+static int xxx_read_req_cmp(void *priv, const struct list_head *a,
+			    const struct list_head *b)
+{
+	const struct xxx_read_req *ra = list_entry(a, struct xxx_read_req, node);
+	const struct xxx_read_req *rb = list_entry(b, struct xxx_read_req, node);
+
+	return ra->off < rb->off ? -1 : ra->off > rb->off;
+}
+
+/* 一次连续读[start, start + len)，服务从first开始到stop之前的n个请求，
+ * 调用者持有xxx->lock */
+static void xxx_read_extent(struct xxx_data *xxx, struct xxx_read_req *first,
+			    struct xxx_read_req *stop, loff_t start, size_t len,
+			    unsigned int n)
+{
+	struct xxx_read_req *r;
+	char *bounce = NULL;
+	ssize_t got, avail;
+
+	if (n == 1) {
+		got = xxx_read_chip(xxx, first->buf, start, len);
+	} else {
+		bounce = kvmalloc(len, GFP_KERNEL);
+		if (!bounce) {
+			/* 没有内存时退回逐个读 */
+			for (r = first; r != stop; r = list_next_entry(r, node)) {
+				r->status = xxx_read_chip(xxx, r->buf, r->off, r->count);
+				xxx->rq_extents++;
+				xxx->rq_bytes_requested += r->count;
+				xxx->rq_bytes_read += r->count;
+			}
+			xxx->rq_requests += n;
+			return;
+		}
+		got = xxx_read_chip(xxx, bounce, start, len);
+	}
+
+	/* 合并读只读到一部分时，完全落在已读部分内的请求照常完成 */
+	for (r = first; r != stop; r = list_next_entry(r, node)) {
+		if (got < 0) {
+			r->status = got;
+		} else {
+			avail = got - (r->off - start);
+			if (avail <= 0) {
+				r->status = -EIO;
+			} else {
+				r->status = min_t(ssize_t, avail, r->count);
+				if (bounce)
+					memcpy(r->buf, bounce + (r->off - start), r->status);
+			}
+		}
+		xxx->rq_bytes_requested += r->count;
+	}
+	xxx->rq_requests += n;
+	xxx->rq_extents++;
+	xxx->rq_bytes_read += len;
+
+	kvfree(bounce);
+}
+
+/* 按偏移排序后合并成最少的连续读 */
+static void xxx_read_batch(struct xxx_data *xxx, struct list_head *batch)
+{
+	struct xxx_read_req *req, *first;
+	loff_t start, end;
+	unsigned int n;
+
+	list_sort(NULL, batch, xxx_read_req_cmp);
+
+	mutex_lock(&xxx->lock);
+	xxx->rq_batches++;
+	req = list_first_entry(batch, struct xxx_read_req, node);
+	while (&req->node != batch) {
+		first = req;
+		start = req->off;
+		end = req->off + req->count;
+		n = 1;
+		list_for_each_entry_continue(req, batch, node) {
+			if (req->off > end + coalesce_gap)
+				break;
+			end = max_t(loff_t, end, req->off + req->count);
+			n++;
+		}
+		xxx_read_extent(xxx, first, req, start, end - start, n);
+	}
+	mutex_unlock(&xxx->lock);
+}
+
+/*
+ * 请求先挂到rq_pending上。没有人在处理时自己成为领头者，取走当前排队的
+ * 全部请求（包括自己）合并读；否则睡眠等待，领头者处理完一批后完成这批
+ * 的等待者，并把领头的身份交给排队中的第一个请求，由它处理在这期间到达
+ * 的下一批。这样每个读者最多等两批，总线忙得越久，每批合并得越多。
+ */
+static ssize_t xxx_read_coalesced(struct xxx_data *xxx,
+					char *buf, loff_t off, size_t count)
+{
+	struct xxx_read_req req = {
+		.off = off,
+		.count = count,
+		.buf = buf,
+	};
+	struct xxx_read_req *r, *tmp, *next;
+	LIST_HEAD(batch);
+	bool leader;
+
+	init_completion(&req.done);
+
+	spin_lock(&xxx->rq_lock);
+	list_add_tail(&req.node, &xxx->rq_pending);
+	leader = !xxx->rq_busy;
+	xxx->rq_busy = true;
+	spin_unlock(&xxx->rq_lock);
+
+	if (!leader) {
+		/* 请求在栈上，不能被信号打断 */
+		wait_for_completion(&req.done);
+		if (!req.leader)
+			return req.status;
+	}
+
+	spin_lock(&xxx->rq_lock);
+	list_splice_init(&xxx->rq_pending, &batch);
+	spin_unlock(&xxx->rq_lock);
+
+	xxx_read_batch(xxx, &batch);
+
+	spin_lock(&xxx->rq_lock);
+	next = list_first_entry_or_null(&xxx->rq_pending, struct xxx_read_req, node);
+	if (!next)
+		xxx->rq_busy = false;
+	spin_unlock(&xxx->rq_lock);
+
+	/* complete()之后等待者可能立即返回，先取下一个再唤醒 */
+	list_for_each_entry_safe(r, tmp, &batch, node)
+		if (r != &req)
+			complete(&r->done);
+	if (next) {
+		next->leader = true;
+		complete(&next->done);
+	}
+
+	return req.status;
+}
+
+static inline bool xxx_reg_in(struct xxx_data *xxx, unsigned int reg,
+			      const struct regmap_access_table *table)
+{
+	return table && regmap_check_range_table(xxx->regmap, reg, table);
+}
+
+/* 批量期间可以只写缓存、提交时一起写出的寄存器 */
+static inline bool xxx_reg_batchable(struct xxx_data *xxx, unsigned int reg)
+{
+	return xxx_reg_in(xxx, reg, xxx->regs->wr_table) &&
+	       !xxx_reg_in(xxx, reg, xxx->regs->volatile_table);
+}
+
+static int xxx_reg_read(struct xxx_data *xxx, unsigned int reg, unsigned int *val)
+{
+	return regmap_read(xxx->regmap, reg, val);
+}
+
+/* 不在批量期间时立即写到芯片；批量期间只更新缓存并记下脏寄存器，
+ * 易失寄存器不能缓存，批量期间写它返回-EBUSY */
+static int xxx_reg_write(struct xxx_data *xxx, unsigned int reg, unsigned int val)
+{
+	int ret;
+
+	mutex_lock(&xxx->regs_lock);
+	if (xxx->regs_batching && !xxx_reg_batchable(xxx, reg)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	ret = regmap_write(xxx->regmap, reg, val);
+	if (ret)
+		goto out;
+	xxx->reg_writes++;
+	if (xxx->regs_batching)
+		__set_bit(reg, xxx->regs_dirty);
+out:
+	mutex_unlock(&xxx->regs_lock);
+
+	return ret;
+}
+
+static int xxx_regs_batch_begin(struct xxx_data *xxx)
+{
+	if (regcache == 0)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&xxx->regs_lock);
+	if (!xxx->regs_batching) {
+		xxx->regs_batching = true;
+		regcache_cache_only(xxx->regmap, true);
+	}
+	mutex_unlock(&xxx->regs_lock);
+
+	return 0;
+}
+
+/*
+ * 结束批量，把期间写过的寄存器写到芯片。从每个脏寄存器开始向后延伸，
+ * 直到遇到不可写或易失的寄存器，其中第一个到最后一个脏寄存器用一次
+ * regmap_raw_write()写出（芯片地址自动递增），中间没改过的寄存器按缓存
+ * 的值重写一遍，比多一次传输便宜。通常的一组配置寄存器就是一次写。
+ */
+static int xxx_regs_batch_commit(struct xxx_data *xxx)
+{
+	unsigned int size = xxx->regs->max_register + 1;
+	unsigned int start, end, last, reg, val;
+	u8 vals[XXX_REGS_MAX];
+	int ret = 0, err = 0;
+
+	mutex_lock(&xxx->regs_lock);
+	if (!xxx->regs_batching)
+		goto out;
+	xxx->regs_batching = false;
+	regcache_cache_only(xxx->regmap, false);
+
+	for (start = find_first_bit(xxx->regs_dirty, size); start < size;
+	     start = find_next_bit(xxx->regs_dirty, size, end + 1)) {
+		last = start;
+		for (end = start + 1; end < size && xxx_reg_batchable(xxx, end); end++)
+			if (test_bit(end, xxx->regs_dirty))
+				last = end;
+		end = last;
+
+		/* 非易失寄存器从缓存读，不访问总线 */
+		for (reg = start; reg <= end; reg++) {
+			err = xxx_reg_read(xxx, reg, &val);
+			if (err)
+				break;
+			vals[reg - start] = val;
+		}
+		if (!err)
+			err = regmap_raw_write(xxx->regmap, start, vals, end - start + 1);
+		if (err && !ret)
+			ret = err;
+		xxx->reg_flushes++;
+		xxx->reg_flush_bytes += end - start + 1;
+	}
+	bitmap_zero(xxx->regs_dirty, XXX_REGS_MAX);
+out:
+	mutex_unlock(&xxx->regs_lock);
+
+	return ret;
+}
+
+/* 芯片掉电或总线复位后寄存器回到复位值，把整个缓存一次同步回去 */
+static int xxx_regs_sync(struct xxx_data *xxx)
+{
+	int ret;
+
+	if (regcache == 0)
+		return 0;
+
+	mutex_lock(&xxx->regs_lock);
+	regcache_cache_only(xxx->regmap, xxx->regs_batching);
+	regcache_mark_dirty(xxx->regmap);
+	ret = regcache_sync(xxx->regmap);
+	xxx->reg_syncs++;
+	mutex_unlock(&xxx->regs_lock);
+
+	return ret;
+}
+
+/* sysfs eeprom节点对寄存器型设备就是寄存器转储：可读且不是precious的
+ * 连续寄存器一次regmap_bulk_read（缓存命中的不访问总线），
+ * 不可读和precious的寄存器读出0 */
+static ssize_t xxx_regs_read(struct xxx_data *xxx,
+					char *buf, loff_t off, size_t count)
+{
+	unsigned int reg = off, end = off + count, start;
+	int ret;
+
+	while (reg < end) {
+		if (!xxx_reg_in(xxx, reg, xxx->regs->rd_table) ||
+		    xxx_reg_in(xxx, reg, xxx->regs->precious_table)) {
+			buf[reg++ - off] = 0;
+			continue;
+		}
+		for (start = reg++; reg < end; reg++)
+			if (!xxx_reg_in(xxx, reg, xxx->regs->rd_table) ||
+			    xxx_reg_in(xxx, reg, xxx->regs->precious_table))
+				break;
+		ret = regmap_bulk_read(xxx->regmap, start, buf + start - off, reg - start);
+		if (ret)
+			return start > off ? start - off : ret;
+	}
+
+	return count;
+}
+
+static ssize_t xxx_regs_write(struct xxx_data *xxx,
+					const char *buf, loff_t off, size_t count)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		ret = xxx_reg_write(xxx, off + i, (u8)buf[i]);
+		if (ret)
+			return i ? i : ret;
+	}
+
+	return count;
+}
+
+static ssize_t xxx_read(struct xxx_data *xxx,
+					char *buf, loff_t off, size_t count)
+{
+	unsigned int first, last;
+	ssize_t retval;
+
+	if (unlikely(!count))
+		return count;
+
+	if (xxx->regmap)
+		return xxx_regs_read(xxx, buf, off, count);
+
+	if (!xxx->shadow && coalesce)
+		return xxx_read_coalesced(xxx, buf, off, count);
+
+	mutex_lock(&xxx->lock);
+	if (!xxx->shadow) {
+		retval = xxx_read_chip(xxx, buf, off, count);
+		goto out;
+	}
+
+	first = off / XXX_SHADOW_PAGE_SIZE;
+	last = DIV_ROUND_UP(off + count, XXX_SHADOW_PAGE_SIZE);
+	if (find_next_zero_bit(xxx->shadow_valid, last, first) < last) {
+		xxx->shadow_misses++;
+		if (shadow_mode == XXX_SHADOW_FULL)
+			retval = xxx_shadow_fill(xxx, 0, xxx->chip.byte_len);
+		else
+			retval = xxx_shadow_fill(xxx, off, count);
+		if (retval < 0)
+			goto out;
+	} else {
+		xxx->shadow_hits++;
+	}
+
+	memcpy(buf, xxx->shadow + off, count);
+	retval = count;
+out:
+	mutex_unlock(&xxx->lock);
+
+	return retval;
+}
+
+static ssize_t xxx_write(struct xxx_data *xxx,
+					const char *buf, loff_t off, size_t count)
+{
+	ktime_t start;
+	u64 elapsed;
+	ssize_t retval;
+
+	if (unlikely(!count))
+		return count;
+
+	if (xxx->regmap)
+		return xxx_regs_write(xxx, buf, off, count);
+
+	mutex_lock(&xxx->lock);
+	start = ktime_get();
+	retval = xxx_write_chip(xxx, buf, off, count);
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	xxx->write_time_ns += elapsed;
+	if (retval > 0) {
+		xxx->write_bytes += retval;
+		xxx_shadow_update(xxx, buf, off, retval);
+	}
+	mutex_unlock(&xxx->lock);
+
+	dev_dbg(&xxx->client->dev, "wrote %zd bytes in %llu us\n",
+		retval, div_u64(elapsed, NSEC_PER_USEC));
 
 	return retval;
 }
@@ -224,32 +1245,827 @@ static ssize_t xxx_bin_read(struct file *filp, struct kobject *kobj,
 	return xxx_read(xxx, buf, off, count);
 }
 
+static ssize_t xxx_bin_write(struct file *filp, struct kobject *kobj,
+				struct bin_attribute *attr,
+				char *buf, loff_t off, size_t count)
+{
+	struct xxx_data *xxx;
+
+	xxx = dev_get_drvdata(container_of(kobj, struct device, kobj));
+	return xxx_write(xxx, buf, off, count);
+}
+
+static void xxx_prefetch_work(struct work_struct *work)
+{
+	struct xxx_data *xxx = container_of(work, struct xxx_data, prefetch_work);
+	unsigned int off, len;
+	int ret = 0;
+
+	for (off = 0; off < xxx->chip.byte_len; off += len) {
+		len = min_t(unsigned int, XXX_PREFETCH_CHUNK, xxx->chip.byte_len - off);
+
+		mutex_lock(&xxx->lock);
+		ret = xxx_shadow_fill(xxx, off, len);
+		mutex_unlock(&xxx->lock);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		dev_warn(&xxx->client->dev, "prefetch failed at %u: %d\n", off, ret);
+	else
+		dev_info(&xxx->client->dev, "%u bytes ready %lld us after probe\n",
+			 xxx->chip.byte_len,
+			 ktime_us_delta(ktime_get(), xxx->probe_start));
+}
+
+/* 只读字符设备/dev/xxx-<bus>-<addr>：read()与sysfs的eeprom节点相同，
+ * mmap()把内核中的影子缓存直接映射到用户空间，用户程序在映射上
+ * 原地解析校准表，第一次缺页之后不再需要任何系统调用。
+ * 映射的最后一页是struct xxx_mmap_status，影子被更新时seq先变为
+ * 奇数、更新完成后再变为偶数，用户程序按seqlock的方式读取：
+ *	do {
+ *		seq = status->seq; rmb();
+ *		parse(map);
+ *		rmb();
+ *	} while ((seq & 1) || seq != status->seq); */
+static void xxx_data_free(struct kref *ref)
+{
+	struct xxx_data *xxx = container_of(ref, struct xxx_data, ref);
+
+	vfree(xxx->shadow);
+	kfifo_free(&xxx->samples);
+	kfree(xxx);
+}
+
+/* probe的引用，设备解绑（或probe失败）时由devm放掉 */
+static void xxx_data_put(void *data)
+{
+	struct xxx_data *xxx = data;
+
+	kref_put(&xxx->ref, xxx_data_free);
+}
+
+/* misc_open()持有misc_mtx调用open，与remove中的misc_deregister()互斥，
+ * 此时probe的引用还在 */
+static int xxx_cdev_open(struct inode *inode, struct file *filp)
+{
+	struct miscdevice *misc = filp->private_data;
+	struct xxx_data *xxx = container_of(misc, struct xxx_data, miscdev);
+
+	kref_get(&xxx->ref);
+	filp->private_data = xxx;
+
+	return 0;
+}
+
+static int xxx_cdev_release(struct inode *inode, struct file *filp)
+{
+	xxx_data_put(filp->private_data);
+
+	return 0;
+}
+
+static ssize_t xxx_cdev_read(struct file *filp, char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct xxx_data *xxx = filp->private_data;
+	ssize_t ret;
+	char *buf;
+
+	if (*ppos >= xxx->chip.byte_len)
+		return 0;
+	count = min_t(size_t, count, xxx->chip.byte_len - *ppos);
+	count = min_t(size_t, count, PAGE_SIZE);
+
+	buf = kmalloc(count, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	down_read(&xxx->remove_sem);
+	if (xxx->removed)
+		ret = -ENODEV;
+	else
+		ret = xxx_read(xxx, buf, *ppos, count);
+	up_read(&xxx->remove_sem);
+	if (ret > 0) {
+		if (copy_to_user(ubuf, buf, ret))
+			ret = -EFAULT;
+		else
+			*ppos += ret;
+	}
+	kfree(buf);
+
+	return ret;
+}
+
+static loff_t xxx_cdev_llseek(struct file *filp, loff_t off, int whence)
+{
+	struct xxx_data *xxx = filp->private_data;
+
+	return fixed_size_llseek(filp, off, whence, xxx->chip.byte_len);
+}
+
+static int xxx_cdev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct xxx_data *xxx = filp->private_data;
+	int ret;
+
+	/* 只读映射，不允许之后再mprotect成可写 */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	/* 映射之前把整个芯片读进影子，之后访问映射不再触发总线传输 */
+	down_read(&xxx->remove_sem);
+	if (xxx->removed) {
+		up_read(&xxx->remove_sem);
+		return -ENODEV;
+	}
+	mutex_lock(&xxx->lock);
+	ret = xxx_shadow_fill(xxx, 0, xxx->chip.byte_len);
+	if (!ret)
+		xxx->mapped = true;
+	mutex_unlock(&xxx->lock);
+	up_read(&xxx->remove_sem);
+	if (ret)
+		return ret;
+
+	/* 映射持有文件，文件持有xxx的引用，解除映射之前影子不会被释放 */
+	return remap_vmalloc_range(vma, xxx->shadow, vma->vm_pgoff);
+}
+
+static const struct file_operations xxx_cdev_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xxx_cdev_open,
+	.release	= xxx_cdev_release,
+	.read		= xxx_cdev_read,
+	.llseek		= xxx_cdev_llseek,
+	.mmap		= xxx_cdev_mmap,
+};
+
+/* 数据就绪中断：硬中断里只记录时间戳，在中断线程里用一次SMBus块读
+ * 读回整组数据寄存器，连同时间戳放入kfifo。用户通过
+ * /dev/xxx-samples-<bus>-<addr>读取，FIFO中的样本数达到水位
+ * （sysfs的sample_watermark）才唤醒read()/poll()，消费者每批唤醒一次，
+ * 而不是每个样本一次，也不再需要轮询从设备是否有新数据。 */
+static irqreturn_t xxx_irq_handler(int irq, void *dev_id)
+{
+	struct xxx_data *xxx = dev_id;
+
+	xxx->irq_timestamp = ktime_get_boottime_ns();
+
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t xxx_irq_thread(int irq, void *dev_id)
+{
+	struct xxx_data *xxx = dev_id;
+	struct xxx_sample sample = {};
+	int ret;
+
+	sample.timestamp = xxx->irq_timestamp;
+	ret = i2c_smbus_read_i2c_block_data(xxx->client, XXX_DATA_REG,
+					    XXX_SAMPLE_LEN, sample.data);
+	if (ret != XXX_SAMPLE_LEN) {
+		dev_dbg(&xxx->client->dev, "sample read failed: %d\n", ret);
+		return IRQ_HANDLED;
+	}
+
+	/* 中断线程是唯一的生产者，放入时不需要加锁 */
+	if (!kfifo_put(&xxx->samples, sample))
+		xxx->samples_dropped++;
+
+	if (kfifo_len(&xxx->samples) >= READ_ONCE(xxx->sample_watermark))
+		wake_up_interruptible(&xxx->sample_wait);
+
+	return IRQ_HANDLED;
+}
+
+static int xxx_sample_open(struct inode *inode, struct file *filp)
+{
+	struct miscdevice *misc = filp->private_data;
+	struct xxx_data *xxx = container_of(misc, struct xxx_data, sample_miscdev);
+
+	kref_get(&xxx->ref);
+	filp->private_data = xxx;
+
+	return 0;
+}
+
+static bool xxx_samples_ready(struct xxx_data *xxx)
+{
+	return kfifo_len(&xxx->samples) >= READ_ONCE(xxx->sample_watermark) ||
+		READ_ONCE(xxx->removed);
+}
+
+/* 每次返回整数个struct xxx_sample */
+static ssize_t xxx_sample_read(struct file *filp, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct xxx_data *xxx = filp->private_data;
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct xxx_sample))
+		return -EINVAL;
+
+	if (!xxx_samples_ready(xxx)) {
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(xxx->sample_wait,
+					       xxx_samples_ready(xxx));
+		if (ret)
+			return ret;
+	}
+
+	/* 可能有多个读者，kfifo只允许一个消费者 */
+	if (mutex_lock_interruptible(&xxx->sample_read_lock))
+		return -ERESTARTSYS;
+	down_read(&xxx->remove_sem);
+	if (xxx->removed)
+		ret = -ENODEV;
+	else
+		ret = kfifo_to_user(&xxx->samples, buf, count, &copied);
+	up_read(&xxx->remove_sem);
+	mutex_unlock(&xxx->sample_read_lock);
+
+	return ret ? ret : copied;
+}
+
+static __poll_t xxx_sample_poll(struct file *filp, poll_table *wait)
+{
+	struct xxx_data *xxx = filp->private_data;
+
+	poll_wait(filp, &xxx->sample_wait, wait);
+
+	if (READ_ONCE(xxx->removed))
+		return EPOLLERR | EPOLLHUP;
+
+	return xxx_samples_ready(xxx) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static const struct file_operations xxx_sample_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xxx_sample_open,
+	.release	= xxx_cdev_release,
+	.read		= xxx_sample_read,
+	.poll		= xxx_sample_poll,
+	.llseek		= no_llseek,
+};
+
+static ssize_t sample_watermark_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", xxx->sample_watermark);
+}
+
+static ssize_t sample_watermark_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val == 0 || val > kfifo_size(&xxx->samples))
+		return -EINVAL;
+
+	WRITE_ONCE(xxx->sample_watermark, val);
+	/* 调低水位后可能已经满足条件 */
+	wake_up_interruptible(&xxx->sample_wait);
+
+	return count;
+}
+static DEVICE_ATTR_RW(sample_watermark);
+
+static ssize_t samples_dropped_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", xxx->samples_dropped);
+}
+static DEVICE_ATTR_RO(samples_dropped);
+
+static struct attribute *xxx_sample_attrs[] = {
+	&dev_attr_sample_watermark.attr,
+	&dev_attr_samples_dropped.attr,
+	NULL
+};
+
+static const struct attribute_group xxx_sample_attr_group = {
+	.attrs = xxx_sample_attrs,
+};
+
+/* 只有板级信息/设备树中给出了irq的设备才使用中断采集 */
+static int xxx_sample_init(struct xxx_data *xxx)
+{
+	struct i2c_client *client = xxx->client;
+	int err;
+
+	if (client->irq <= 0)
+		return 0;
+
+	err = kfifo_alloc(&xxx->samples, XXX_SAMPLE_FIFO_SIZE, GFP_KERNEL);
+	if (err)
+		return err;
+	mutex_init(&xxx->sample_read_lock);
+	init_waitqueue_head(&xxx->sample_wait);
+	xxx->sample_watermark = 1;
+
+	err = devm_request_threaded_irq(&client->dev, client->irq,
+					xxx_irq_handler, xxx_irq_thread,
+					IRQF_ONESHOT, dev_name(&client->dev), xxx);
+	if (err)
+		goto err_free;
+
+	snprintf(xxx->sample_miscname, sizeof(xxx->sample_miscname),
+		 "xxx-samples-%d-%04x", i2c_adapter_id(client->adapter),
+		 client->addr);
+	xxx->sample_miscdev.minor = MISC_DYNAMIC_MINOR;
+	xxx->sample_miscdev.name = xxx->sample_miscname;
+	xxx->sample_miscdev.fops = &xxx_sample_fops;
+	xxx->sample_miscdev.parent = &client->dev;
+	err = misc_register(&xxx->sample_miscdev);
+	if (err)
+		goto err_irq;
+
+	err = devm_device_add_group(&client->dev, &xxx_sample_attr_group);
+	if (err)
+		goto err_misc;
+
+	return 0;
+
+err_misc:
+	misc_deregister(&xxx->sample_miscdev);
+err_irq:
+	devm_free_irq(&client->dev, client->irq, xxx);
+err_free:
+	kfifo_free(&xxx->samples);
+	return err;
+}
+
+static void xxx_sample_exit(struct xxx_data *xxx)
+{
+	if (xxx->client->irq <= 0)
+		return;
+
+	misc_deregister(&xxx->sample_miscdev);
+	devm_free_irq(&xxx->client->dev, xxx->client->irq, xxx);
+	/* FIFO可能还有打开的fd，留给xxx_data_free()释放 */
+}
+
+/* 写1开始批量，之后的寄存器写只进缓存；写0提交，一次批量写到芯片 */
+static ssize_t reg_batch_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", xxx->regs_batching);
+}
+
+static ssize_t reg_batch_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	ret = val ? xxx_regs_batch_begin(xxx) : xxx_regs_batch_commit(xxx);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(reg_batch);
+
+/* 总线复位后由用户触发，把缓存整体写回芯片 */
+static ssize_t regcache_sync_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int ret = xxx_regs_sync(dev_get_drvdata(dev));
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_WO(regcache_sync);
+
+static ssize_t reg_stats_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return sprintf(buf, "writes %lu\nflushes %lu\nflush_bytes %lu\nsyncs %lu\n",
+		       xxx->reg_writes, xxx->reg_flushes, xxx->reg_flush_bytes,
+		       xxx->reg_syncs);
+}
+static DEVICE_ATTR_RO(reg_stats);
+
+static struct attribute *xxx_regs_attrs[] = {
+	&dev_attr_reg_batch.attr,
+	&dev_attr_regcache_sync.attr,
+	&dev_attr_reg_stats.attr,
+	NULL
+};
+
+static const struct attribute_group xxx_regs_attr_group = {
+	.attrs = xxx_regs_attrs,
+};
+
+/* 名字在xxx_regs_chips中的设备使用regmap，其余设备返回0，照EEPROM访问 */
+static int xxx_regs_init(struct xxx_data *xxx, const struct i2c_device_id *id)
+{
+	static const enum regcache_type types[] = {
+		REGCACHE_NONE, REGCACHE_FLAT, REGCACHE_RBTREE,
+	};
+	const struct xxx_regs_desc *desc = NULL;
+	struct regmap_config cfg = {
+		.reg_bits = 8,
+		.val_bits = 8,
+	};
+	struct regmap *map;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(xxx_regs_chips); i++)
+		if (!strcmp(id->name, xxx_regs_chips[i].name))
+			desc = &xxx_regs_chips[i];
+	if (!desc)
+		return 0;
+
+	cfg.name = desc->name;
+	cfg.max_register = desc->max_register;
+	cfg.rd_table = desc->rd_table;
+	cfg.wr_table = desc->wr_table;
+	cfg.volatile_table = desc->volatile_table;
+	cfg.precious_table = desc->precious_table;
+	cfg.reg_defaults = desc->defaults;
+	cfg.num_reg_defaults = desc->num_defaults;
+	cfg.cache_type = types[min_t(unsigned int, regcache, ARRAY_SIZE(types) - 1)];
+
+	map = devm_regmap_init_i2c(xxx->client, &cfg);
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	mutex_init(&xxx->regs_lock);
+	xxx->regs = desc;
+	xxx->regmap = map;
+
+	return devm_device_add_group(&xxx->client->dev, &xxx_regs_attr_group);
+}
+
+/* 写任意值作废整个影子，下次读时重新从芯片加载 */
+static ssize_t shadow_invalidate_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	xxx_shadow_invalidate(dev_get_drvdata(dev));
+
+	return count;
+}
+static DEVICE_ATTR_WO(shadow_invalidate);
+
+static ssize_t shadow_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return sprintf(buf, "hits %lu\nmisses %lu\n",
+		       xxx->shadow_hits, xxx->shadow_misses);
+}
+static DEVICE_ATTR_RO(shadow_stats);
+
+/* 累计写入量及耗时，用于比较页写+ACK轮询与逐字节写的烧写时间 */
+static ssize_t write_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return sprintf(buf, "bytes %lu\npages %lu\nack_polls %lu\ntime_us %llu\n",
+		       xxx->write_bytes, xxx->write_pages, xxx->write_polls,
+		       div_u64(xxx->write_time_ns, NSEC_PER_USEC));
+}
+static DEVICE_ATTR_RO(write_stats);
+
+/* 合并读统计。saved_bits估算少发的地址阶段（START、从地址、偏移、
+ * 重复START、从地址、STOP）减去多读的空洞、加上重叠部分少读的字节，
+ * 按总线频率换算成时间；为负表示coalesce_gap设得太大 */
+static ssize_t coalesce_stats_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+	unsigned int alen = (xxx->chip.flags & XXX_FLAG_ADDR16) ? 2 : 1;
+	unsigned long requests, batches, extents;
+	u64 requested, read;
+	s64 saved_bits;
+
+	mutex_lock(&xxx->lock);
+	requests = xxx->rq_requests;
+	batches = xxx->rq_batches;
+	extents = xxx->rq_extents;
+	requested = xxx->rq_bytes_requested;
+	read = xxx->rq_bytes_read;
+	mutex_unlock(&xxx->lock);
+
+	saved_bits = (s64)(requests - extents) * (21 + 9 * alen) +
+		     ((s64)requested - (s64)read) * 9;
+
+	return sprintf(buf, "requests %lu\nbatches %lu\nextents %lu\n"
+		       "merge_ratio %lu.%02lu\nbytes_requested %llu\nbytes_read %llu\n"
+		       "saved_bits %lld\nsaved_us %lld\n",
+		       requests, batches, extents,
+		       extents ? requests / extents : 0,
+		       extents ? requests * 100 / extents % 100 : 0,
+		       requested, read, saved_bits,
+		       div_s64(saved_bits * USEC_PER_SEC, xxx->bus_freq));
+}
+static DEVICE_ATTR_RO(coalesce_stats);
+
+static struct attribute *xxx_attrs[] = {
+	&dev_attr_shadow_invalidate.attr,
+	&dev_attr_shadow_stats.attr,
+	&dev_attr_write_stats.attr,
+	&dev_attr_coalesce_stats.attr,
+	NULL
+};
+
+static const struct attribute_group xxx_attr_group = {
+	.attrs = xxx_attrs,
+};
+
+#if IS_ENABLED(CONFIG_EEPROM_XXX_STATS)
+static int xxx_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const names[XXX_STAT_NR] = {
+		"reads", "read_bytes", "writes", "write_bytes",
+		"naks", "timeouts", "retries", "errors",
+	};
+	static const char * const sizes[XXX_SIZE_NR] = { "1-16", "17-255", "256+" };
+	struct xxx_data *xxx = s->private;
+	struct xxx_stats *sum, *p;
+	int cpu, d, i, j;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		p = per_cpu_ptr(xxx->stats, cpu);
+		for (i = 0; i < XXX_STAT_NR; i++)
+			sum->cnt[i] += p->cnt[i];
+		for (d = 0; d < 2; d++)
+			for (i = 0; i < XXX_SIZE_NR; i++)
+				for (j = 0; j < XXX_STAT_LAT_BUCKETS; j++)
+					sum->lat[d][i][j] += p->lat[d][i][j];
+	}
+
+	for (i = 0; i < XXX_STAT_NR; i++)
+		seq_printf(s, "%s %llu\n", names[i], sum->cnt[i]);
+
+	seq_puts(s, "latency_us");
+	for (j = 0; j < XXX_STAT_LAT_BUCKETS - 1; j++)
+		seq_printf(s, " <%lu", 1UL << j);
+	seq_printf(s, " >=%lu\n", 1UL << (j - 1));
+	for (d = 0; d < 2; d++) {
+		for (i = 0; i < XXX_SIZE_NR; i++) {
+			seq_printf(s, "%s:%s", d ? "write" : "read", sizes[i]);
+			for (j = 0; j < XXX_STAT_LAT_BUCKETS; j++)
+				seq_printf(s, " %llu", sum->lat[d][i][j]);
+			seq_putc(s, '\n');
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(xxx_stats);
+
+/* 写任意值清零，不与其他CPU上的累加互斥，清零瞬间可能丢几次计数 */
+static ssize_t xxx_stats_reset_write(struct file *file, const char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	struct xxx_data *xxx = file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(xxx->stats, cpu), 0, sizeof(struct xxx_stats));
+
+	return count;
+}
+
+static const struct file_operations xxx_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = xxx_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+static int xxx_stats_init(struct xxx_data *xxx)
+{
+	xxx->stats = alloc_percpu(struct xxx_stats);
+	if (!xxx->stats)
+		return -ENOMEM;
+
+	/* debugfs失败不影响读写，不检查返回值 */
+	xxx->debugfs = debugfs_create_dir(dev_name(&xxx->client->dev),
+					  xxx_debugfs_root);
+	debugfs_create_file("stats", 0444, xxx->debugfs, xxx, &xxx_stats_fops);
+	debugfs_create_file("reset", 0200, xxx->debugfs, xxx, &xxx_stats_reset_fops);
+
+	return 0;
+}
+
+static void xxx_stats_exit(struct xxx_data *xxx)
+{
+	debugfs_remove_recursive(xxx->debugfs);
+	free_percpu(xxx->stats);
+}
+#else
+static inline int xxx_stats_init(struct xxx_data *xxx)
+{
+	return 0;
+}
+static inline void xxx_stats_exit(struct xxx_data *xxx) {}
+#endif
+
 static int xxx_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
 	...
+	/* xxx用kzalloc申请而不是devm，打开的fd可能比设备活得久 */
+	kref_init(&xxx->ref);
+	init_rwsem(&xxx->remove_sem);
+	err = devm_add_action_or_reset(&client->dev, xxx_data_put, xxx);
+	if (err)
+		return err;
+	xxx->probe_start = ktime_get();
+	mutex_init(&xxx->lock);
+	spin_lock_init(&xxx->rq_lock);
+	INIT_LIST_HEAD(&xxx->rq_pending);
+	xxx->client = client;
+	if (device_property_read_u32(client->adapter->dev.parent, "clock-frequency",
+				     &xxx->bus_freq) || !xxx->bus_freq)
+		xxx->bus_freq = I2C_MAX_STANDARD_MODE_FREQ;
+	INIT_WORK(&xxx->prefetch_work, xxx_prefetch_work);
+
+	/* 需要为xxx申请sizeof(*xxx) + num_addresses个client指针的空间，此处略去 */
+	if (chip.flags & XXX_FLAG_TAKE8ADDR)
+		xxx->num_addresses = 8;
+	else
+		xxx->num_addresses = DIV_ROUND_UP(chip.byte_len,
+			(chip.flags & XXX_FLAG_ADDR16) ? 65536 : 256);
+	xxx->clients[0] = client;
+	/* 其余从地址用dummy client占住，防止被其他驱动绑定 */
+	for (i = 1; i < xxx->num_addresses; i++) {
+		xxx->clients[i] = devm_i2c_new_dummy_device(&client->dev,
+					client->adapter, client->addr + i);
+		if (IS_ERR(xxx->clients[i]))
+			return PTR_ERR(xxx->clients[i]);
+	}
+	xxx_init_xfer_limits(xxx);
+
+	err = xxx_regs_init(xxx, id);
+	if (err)
+		return err;
+
+	if (!(chip.flags & XXX_FLAG_READONLY) && !xxx->regmap) {
+		const struct i2c_adapter_quirks *q = client->adapter->quirks;
+
+		if (!xxx->chip.page_size)
+			xxx->chip.page_size = 1;
+		xxx->write_max = xxx->chip.page_size;
+		/* 适配器限制了写消息长度时，留出地址字节 */
+		if (q && q->max_write_len && xxx->write_max > q->max_write_len - 2)
+			xxx->write_max = q->max_write_len - 2;
+		xxx->writebuf = devm_kzalloc(&client->dev, xxx->write_max + 2,
+					     GFP_KERNEL);
+		if (!xxx->writebuf)
+			return -ENOMEM;
+	}
+
+	if (shadow_mode != XXX_SHADOW_OFF && !xxx->regmap) {
+		xxx->shadow = vmalloc_user(PAGE_ALIGN(chip.byte_len) + PAGE_SIZE);
+		if (!xxx->shadow)
+			return -ENOMEM;
+		xxx->mmap_status = (void *)(xxx->shadow + PAGE_ALIGN(chip.byte_len));
+		xxx->mmap_status->byte_len = chip.byte_len;
+		xxx->shadow_valid = devm_kcalloc(&client->dev,
+				BITS_TO_LONGS(DIV_ROUND_UP(chip.byte_len, XXX_SHADOW_PAGE_SIZE)),
+				sizeof(unsigned long), GFP_KERNEL);
+		if (!xxx->shadow_valid)
+			return -ENOMEM;
+
+		/* 可以mmap的字符设备依赖影子缓存 */
+		snprintf(xxx->miscname, sizeof(xxx->miscname), "xxx-%d-%04x",
+			 i2c_adapter_id(client->adapter), client->addr);
+		xxx->miscdev.minor = MISC_DYNAMIC_MINOR;
+		xxx->miscdev.name = xxx->miscname;
+		xxx->miscdev.fops = &xxx_cdev_fops;
+		xxx->miscdev.parent = &client->dev;
+		err = misc_register(&xxx->miscdev);
+		if (err)
+			return err;
+	}
+
 	sysfs_bin_attr_init(&xxx->bin); //以bin_attribute二进制sysfs节点形式呈现
 	xxx->bin.attr.name = "eeprom";
 	xxx->bin.attr.mode = chip.flags & XXX_FLAG_IRUGO ? S_IRUGO : S_IRUSR;
 	xxx->bin.read = xxx_bin_read;
-	xxx->bin.size = chip.byte_len;
+	xxx->bin.size = xxx->regmap ? xxx->regs->max_register + 1 : chip.byte_len;
+	if (!(chip.flags & XXX_FLAG_READONLY)) {
+		xxx->bin.write = xxx_bin_write;
+		xxx->bin.attr.mode |= S_IWUSR;
+	}
+	...
+	err = devm_device_add_group(&client->dev, &xxx_attr_group);
 	...
 
+	err = xxx_sample_init(xxx);
+	if (err)
+		goto err_bin;
+
+	err = xxx_stats_init(xxx);
+	if (err)
+		goto err_sample;
+
+	/* 后台预读，probe立即返回；没有影子时probe结束即就绪 */
+	if (xxx->shadow && prefetch)
+		queue_work(system_unbound_wq, &xxx->prefetch_work);
+	else
+		dev_dbg(&client->dev, "ready %lld us after probe\n",
+			ktime_us_delta(ktime_get(), xxx->probe_start));
+
+	return 0;
+
+err_sample:
+	xxx_sample_exit(xxx);
+err_bin:
+	sysfs_remove_bin_file(&client->dev.kobj, &xxx->bin);
+	if (xxx->shadow)
+		misc_deregister(&xxx->miscdev);
+	/* 影子随probe的引用由devm放掉 */
 	return err;
 }
 
 static int xxx_remove(struct i2c_client *client)
 {
 	...
+	/* 等fd上进行中的操作结束，之后的操作都返回-ENODEV */
+	down_write(&xxx->remove_sem);
+	xxx->removed = true;
+	up_write(&xxx->remove_sem);
+	if (client->irq > 0)
+		wake_up_interruptible(&xxx->sample_wait);
+
 	sysfs_remove_bin_file(&client->dev.kobj, &xxx->bin);
+	xxx_sample_exit(xxx);
+	cancel_work_sync(&xxx->prefetch_work);
+	xxx_stats_exit(xxx);
+	if (xxx->shadow)
+		misc_deregister(&xxx->miscdev);
+	/* 影子、FIFO和xxx本身在最后一个fd关闭、devm放掉probe的引用之后释放 */
 	...
 
 	return 0;
 }
 
+/* 挂起期间的寄存器写只进缓存，恢复时芯片已回到复位值，整体同步一次 */
+static int __maybe_unused xxx_suspend(struct device *dev)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	if (xxx->regmap && regcache) {
+		mutex_lock(&xxx->regs_lock);
+		regcache_cache_only(xxx->regmap, true);
+		mutex_unlock(&xxx->regs_lock);
+	}
+
+	return 0;
+}
+
+static int __maybe_unused xxx_resume(struct device *dev)
+{
+	struct xxx_data *xxx = dev_get_drvdata(dev);
+
+	return xxx->regmap ? xxx_regs_sync(xxx) : 0;
+}
+
+static SIMPLE_DEV_PM_OPS(xxx_pm_ops, xxx_suspend, xxx_resume);
+
 static struct i2c_driver xxx_driver = {
 	.driver = {
 		.name = "xxx",
 		.owner = THIS_MODULE,
+		/* 各设备的probe可在不同线程中并行执行，不阻塞i2c_add_driver() */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.pm = &xxx_pm_ops,
 	},
 	.probe = xxx_probe;
 	.remove = xxx_remove;
@@ -259,6 +2075,9 @@ static struct i2c_driver xxx_driver = {
 static int __init xxx_init(void)
 {
 	...
+#if IS_ENABLED(CONFIG_EEPROM_XXX_STATS)
+	xxx_debugfs_root = debugfs_create_dir("xxx", NULL);
+#endif
 	return i2c_add_driver(&xxx_driver);
 }
 module_init(xxx_init);
@@ -266,6 +2085,9 @@ module_init(xxx_init);
 static void __exit xxx_exit(void)
 {
 	i2c_del_driver(&xxx_driver);
+#if IS_ENABLED(CONFIG_EEPROM_XXX_STATS)
+	debugfs_remove_recursive(xxx_debugfs_root);
+#endif
 }
 module_exit(xxx_exit);
 
@@ -106,51 +106,2893 @@ struct i2c_adapter {
 
 /**********************代码模板***************************/
 
+/* 中断驱动的传输状态机
+ * 每次传输都是提交队列中的一个请求（struct xxx_i2c_req），xxx_i2c_dispatch()
+ * 只负责为第一条消息发出START和地址；之后由中断（或DMA完成回调）根据
+ * msg/msg_idx/msg_ptr推进到下一批字节或下一条消息。消息之间发重复START，
+ * 只有最后一条消息结束（或出错）时才发STOP，并在同一个中断里直接开始
+ * 队列中的下一个请求，请求之间不需要调度回进程上下文。 */
+enum xxx_i2c_state {
+	STATE_IDLE,
+	STATE_START,
+	STATE_READ,
+	STATE_WRITE,
+	STATE_STOP,
+	STATE_SMBUS	/* 硬件SMBus命令序列器正在执行一条命令 */
+};
+
+/* 每条消息的数据搬运方式，按消息长度选择：
+ * PIO:  每个字节一次中断，适合1~2字节的寄存器访问
+ * FIFO: 每次中断按FIFO水位成批读写，适合中等长度
+ * DMA:  整条消息交给DMA，只在结束时产生一次中断，适合EEPROM、固件等大块数据 */
+enum xxx_i2c_xfer_mode {
+	XXX_XFER_PIO,
+	XXX_XFER_FIFO,
+	XXX_XFER_DMA,
+	XXX_XFER_MODE_NR
+};
+
+#define XXX_I2C_FIFO_DEPTH		16
+#define XXX_I2C_FIFO_THRESHOLD		4	/* 默认长度>=4字节用FIFO */
+#define XXX_I2C_DMA_THRESHOLD		64	/* 默认长度>=64字节用DMA */
+
+static bool use_polling;
+module_param(use_polling, bool, 0644);
+MODULE_PARM_DESC(use_polling, "Use the busy-polling transfer path instead of IRQs");
+
+/* 总线卡死的检测与恢复
+ * 每次传输的超时按消息长度和当前速度估算：名义传输时间的2倍，再加上
+ * stretch_us（从设备时钟延展及中断延迟的余量），而不是固定的adap.timeout。
+ * 过了这个期限但最近stuck_us内还有字节中断，说明从设备在合法地延展
+ * 时钟，继续等待，直到stuck_us内没有任何进展才算超时。
+ * 控制器发START时发现SDA被拉低、或SCL被拉低超过stuck_us时产生
+ * XXX_I2C_STAT_BUS_STUCK中断，立即结束当前传输。SMBus允许从设备把SCL
+ * 拉低最多25ms（T_TIMEOUT），stuck_us不能比它短，否则合法的时钟延展
+ * 也会被当作卡死。超时和卡死都在进程
+ * 上下文中通过bus_recovery_info发最多9个SCL脉冲和STOP恢复总线，
+ * 之后才派发下一个请求。adaptive_timeout=0时退回adap.timeout，用于对比。 */
+static unsigned int stretch_us = 1000;
+module_param(stretch_us, uint, 0444);
+MODULE_PARM_DESC(stretch_us, "Clock-stretching allowance (in us) added to each transfer timeout");
+
+#define XXX_I2C_STUCK_MIN_US	25000	/* SMBus T_TIMEOUT,MIN */
+
+static unsigned int stuck_us = 35000;	/* SMBus T_TIMEOUT,MAX */
+module_param(stuck_us, uint, 0444);
+MODULE_PARM_DESC(stuck_us, "Report the bus as stuck when SCL is held low longer than this (in us, at least 25000)");
+
+static inline unsigned int xxx_i2c_stuck_us(void)
+{
+	return max_t(unsigned int, stuck_us, XXX_I2C_STUCK_MIN_US);
+}
+
+#define XXX_I2C_STUCK_CONFIRM_US	1000	/* 确认总线卡死时持续采样的时间 */
+
+static bool adaptive_timeout = true;
+module_param(adaptive_timeout, bool, 0644);
+MODULE_PARM_DESC(adaptive_timeout, "Derive transfer timeouts from length and bus speed instead of adap.timeout");
+
+/* 卡死与恢复的统计，由i2c->lock保护 */
+struct xxx_i2c_fault_stats {
+	unsigned long stalls;		/* 超时及卡死的次数 */
+	u64 stall_ns;			/* 最后一次进展到检测到的时间 */
+	u64 max_stall_ns;
+	unsigned long recoveries;	/* 需要发时钟脉冲恢复的次数 */
+	unsigned long recovery_failed;
+	u64 recovery_ns;
+	u64 max_recovery_ns;
+};
+
+/* 按客户端选择总线速度：每个从地址记下它支持的最高频率（设备树或
+ * 板级信息swnode中客户端的clock-frequency属性，没有时用适配器的
+ * clock-frequency），每次传输取所涉及从地址中最低的那个，在发START前
+ * 把控制器切换到对应的速度。每档速度的分频值在probe时算好，切换只是
+ * 写一个寄存器，速度不变时什么也不做。
+ * 注意地址阶段对总线上所有设备可见，只有Standard-mode设备同样能容忍
+ * 更快的地址阶段时才应给别的设备声明更高的速度。 */
+#define XXX_I2C_MAX_FREQ		I2C_MAX_FAST_MODE_PLUS_FREQ	/* 控制器不支持高速模式 */
+#define XXX_I2C_NR_SPEEDS		4	/* 100k、400k、1M及适配器的默认速度 */
+
+struct xxx_i2c_speed {
+	u32 freq;
+	u32 div;		/* 预先算好的分频寄存器值 */
+	unsigned long xfers;	/* 以此速度发出的传输数 */
+};
+
+/* 一条用DMA传输的消息对应的DMA安全缓冲区及其映射 */
+struct xxx_i2c_dma_buf {
+	u8 *buf;
+	dma_addr_t addr;
+};
+
+/* 请求的优先级类别：HIGH给延迟敏感的寄存器访问，BULK给EEPROM、固件等
+ * 大块传输。调度时HIGH优先，但连续服务XXX_I2C_HIGH_BURST个HIGH请求后
+ * 必须让一个BULK请求，BULK不会被饿死；HIGH请求最多等待一个正在进行的
+ * BULK传输。 */
+enum xxx_i2c_prio {
+	XXX_PRIO_HIGH,
+	XXX_PRIO_BULK,
+	XXX_PRIO_NR
+};
+
+#define XXX_I2C_HIGH_BURST		8
+#define XXX_I2C_HIGH_LEN		8	/* 同步传输总长度不超过它时按HIGH提交 */
+
+/* 一次传输请求（一组在START...STOP之间原子执行的消息）。
+ * 由调用者分配，在complete回调之前不能释放，msgs及其buf也一样。
+ * 实际使用时应放到include/linux/platform_data/下供客户驱动包含。 */
+struct xxx_i2c_req {
+	struct list_head node;
+	struct i2c_msg *msgs;
+	int num;
+	enum xxx_i2c_prio prio;
+	/* 在中断、DMA完成回调或工作队列上下文中调用，不能睡眠，
+	 * 也不能在其中调用xxx_i2c_submit()；
+	 * status为成功传输的消息数或负的错误码 */
+	void (*complete)(struct xxx_i2c_req *req, int status);
+	void *context;		/* 调用者私有数据 */
+
+	/* 以下由驱动使用 */
+	int status;
+	ktime_t submitted;
+	ktime_t started;
+	struct xxx_i2c_dma_buf *dma;
+	u8 speed;		/* i2c->speeds[]的下标，提交时选定 */
+};
+
+/* 每个优先级类别的队列统计，由i2c->lock保护 */
+struct xxx_i2c_qstats {
+	unsigned int depth;		/* 当前排队的请求数，不含正在传输的 */
+	unsigned int max_depth;
+	unsigned long count;		/* 已完成的请求数 */
+	u64 wait_ns;			/* 提交到开始传输 */
+	u64 max_wait_ns;
+	u64 service_ns;			/* 开始传输到完成 */
+	u64 max_service_ns;
+};
+
+/* 传输统计，CONFIG_I2C_XXX_STATS关闭时下面的统计函数都是空的内联函数，
+ * 不占用任何空间和时间。计数器是per-CPU的，中断和进程上下文中都只加
+ * 本CPU的副本，热路径上不需要任何共享锁，读debugfs时才把各CPU的值加起来。 */
+enum xxx_i2c_stat {
+	XXX_STAT_XFERS,
+	XXX_STAT_MSGS,
+	XXX_STAT_RD_BYTES,
+	XXX_STAT_WR_BYTES,
+	XXX_STAT_NAKS,
+	XXX_STAT_ARB_LOST,
+	XXX_STAT_TIMEOUTS,
+	XXX_STAT_RETRIES,	/* 返回-EAGAIN让i2c核心重试的次数 */
+	XXX_STAT_RECOVERIES,	/* 通过bus_recovery_info恢复总线的次数 */
+	XXX_STAT_NR
+};
+
+/* 延迟直方图按一次传输的总字节数分组 */
+enum xxx_i2c_size_class {
+	XXX_SIZE_SMALL,		/* 1~4字节，寄存器访问 */
+	XXX_SIZE_MEDIUM,	/* 5~63字节 */
+	XXX_SIZE_LARGE,		/* 64字节以上 */
+	XXX_SIZE_NR
+};
+
+/* 第0个桶是不到1us，第i个桶是[2^(i-1), 2^i)us，最后一个桶不封顶 */
+#define XXX_STAT_LAT_BUCKETS		20
+
+#if IS_ENABLED(CONFIG_I2C_XXX_STATS)
+struct xxx_i2c_stats {
+	u64 cnt[XXX_STAT_NR];
+	u64 lat[XXX_SIZE_NR][XXX_STAT_LAT_BUCKETS];
+};
+#endif
+
+/* 传输捕获（CONFIG_I2C_XXX_TRACE，依赖CONFIG_I2C_XXX_STATS的debugfs目录）
+ * 开启后每次传输结束时把每条i2c_msg的地址、标志、长度和最多
+ * trace_payload字节的数据追加到本CPU的环形缓冲区，写者关中断、
+ * 不加锁；/sys/kernel/debug/xxx_i2c.N/trace读出并清空所有CPU的缓冲区。
+ * 读出的格式：struct xxx_i2c_trace_file_hdr，之后是一个个传输记录——
+ * struct xxx_i2c_trace_xfer加nmsgs个（struct xxx_i2c_trace_msg加
+ * data_len字节数据），没有填充。同一CPU的记录按时间先后，
+ * 不同CPU之间不保证，需要的话按timestamp排序。
+ * i2c_app/i2c_trace.h定义了相同的格式，供用户空间的捕获和回放使用。 */
+#define XXX_I2C_TRACE_MAGIC	0x54433249	/* "I2CT" */
+#define XXX_I2C_TRACE_VERSION	1
+
+struct xxx_i2c_trace_file_hdr {
+	__u32 magic;
+	__u16 version;
+	__u16 payload;
+};
+
+struct xxx_i2c_trace_xfer {
+	__u64 timestamp;	/* 传输开始的时间，CLOCK_MONOTONIC，ns */
+	__u32 duration;		/* ns */
+	__s16 result;		/* 完成的消息数或负的错误码 */
+	__u8 nmsgs;
+	__u8 bus;
+};
+
+struct xxx_i2c_trace_msg {
+	__u16 addr;
+	__u16 flags;
+	__u16 len;
+	__u16 data_len;		/* 记录下来的数据字节数，不超过len */
+};
+
+struct xxx_i2c_trace_buf {
+	u32 head;		/* 只由本CPU写 */
+	u32 tail;		/* 只由trace文件的读者写 */
+	u32 mask;
+	u64 lost;		/* 缓冲区满丢弃的传输数 */
+	u8 data[];
+};
+
 struct xxx_i2c {
-	spinlock_t lock;
-	wait_queue_head_t wait;
-	struct i2c_msg *msg;
-	unsigned int msg_num;
-	unsigned int msg_idx;
-	unsigned int msg_ptr;
+	spinlock_t lock;	/* 保护下面的状态机及队列字段，中断和进程上下文共用 */
+	wait_queue_head_t wait;	/* SMBus命令完成、出错时唤醒xxx_i2c_smbus_xfer() */
+	struct list_head queue[XXX_PRIO_NR];	/* 等待传输的请求 */
+	struct xxx_i2c_req *cur;	/* 正在传输的请求，空闲时为NULL */
+	struct list_head done;		/* 已完成、等待在锁外调用回调的请求 */
+	unsigned int high_streak;	/* 连续服务的HIGH请求数 */
+	struct xxx_i2c_qstats qstats[XXX_PRIO_NR];
+	struct hrtimer timer;		/* 当前请求的超时 */
+	ktime_t deadline;
+	ktime_t progress;		/* 当前请求最近一次有进展的时间 */
+	int stall_status;		/* 中断报告总线卡死时为-EBUSY */
+	struct work_struct timeout_work;
+	struct i2c_msg *msg;	/* 当前正在传输的消息 */
+	unsigned int msg_num;	/* 本次传输的消息数，为0表示传输已结束 */
+	unsigned int msg_idx;	/* 当前消息的序号，结束后存放返回值 */
+	unsigned int msg_ptr;	/* 当前消息中下一个要传输的字节 */
+	enum xxx_i2c_state state;
+	int irq;
+
+	enum xxx_i2c_xfer_mode mode;	/* 当前消息使用的搬运方式 */
+	unsigned int fifo_threshold;	/* 可通过sysfs按适配器调节 */
+	unsigned int dma_threshold;
+	unsigned long mode_hits[XXX_XFER_MODE_NR];	/* 每种方式服务的消息数 */
+	struct dma_chan *dma_tx;	/* 没有DMA通道时为NULL */
+	struct dma_chan *dma_rx;
+	struct xxx_i2c_dma_buf *dma;	/* 当前请求中每条消息的DMA缓冲区 */
+	/* DMA写消息要等DMA完成回调和控制器的发送完成中断都到了才算结束，
+	 * 两者先后不定，由i2c->lock保护，后到的一方结束消息 */
+	bool dma_done;
+	bool tx_done;
+	int smbus_status;		/* SMBus命令的执行结果，由中断填写 */
+	bool smbus_active;		/* 序列器占用控制器期间不派发队列中的请求 */
+
+	struct i2c_timings timings;	/* 适配器的clock-frequency及上升/下降时间 */
+	struct xxx_i2c_speed speeds[XXX_I2C_NR_SPEEDS];	/* 按频率升序 */
+	unsigned int nr_speeds;
+	unsigned int default_speed;	/* 没有声明速度的从地址使用的档位 */
+	unsigned int cur_speed;		/* 控制器当前的档位 */
+	unsigned long retimes;		/* 切换速度的次数 */
+	u32 addr_freq[128];		/* 每个7位从地址支持的最高频率 */
+	struct notifier_block bus_nb;	/* 跟踪客户端的添加和删除 */
+
+	struct i2c_bus_recovery_info rinfo;
+	struct xxx_i2c_fault_stats faults;
+#if IS_ENABLED(CONFIG_I2C_XXX_STATS)
+	struct xxx_i2c_stats __percpu *stats;
+	struct dentry *debugfs;
+#endif
+#if IS_ENABLED(CONFIG_I2C_XXX_TRACE)
+	struct xxx_i2c_trace_buf * __percpu *trace;	/* 第一次开启捕获时分配 */
+	bool trace_on;
+	u32 trace_payload;		/* 每条消息最多记录的数据字节数 */
+	struct mutex trace_lock;	/* 分配缓冲区、读者之间互斥 */
+#endif
+#if IS_ENABLED(CONFIG_I2C_SLAVE)
+	struct i2c_client *slave;	/* 以slave模式注册的客户端，没有时为NULL */
+#endif
 	...
 	struct i2c_adapter adap;
 };
 
-static int xxx_i2c_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
-		int num)
+static inline int is_lastmsg(struct xxx_i2c *i2c)
+{
+	return i2c->msg_idx >= (i2c->msg_num - 1);
+}
+
+static inline int is_msglast(struct xxx_i2c *i2c)
+{
+	return i2c->msg_ptr == i2c->msg->len - 1;
+}
+
+static inline int is_msgend(struct xxx_i2c *i2c)
+{
+	return i2c->msg_ptr >= i2c->msg->len;
+}
+
+#if IS_ENABLED(CONFIG_I2C_XXX_STATS)
+static inline void xxx_i2c_stat_add(struct xxx_i2c *i2c, enum xxx_i2c_stat id,
+				    unsigned int val)
+{
+	this_cpu_add(i2c->stats->cnt[id], val);
+}
+
+/* 一次传输结束时调用，nmsgs为成功传输的消息数，ns为从START到结束的时间 */
+static void xxx_i2c_stat_xfer(struct xxx_i2c *i2c, unsigned int nmsgs,
+			      unsigned int rd, unsigned int wr, u64 ns)
+{
+	unsigned int len = rd + wr;
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int size, bucket;
+
+	size = len <= 4 ? XXX_SIZE_SMALL : len < 64 ? XXX_SIZE_MEDIUM : XXX_SIZE_LARGE;
+	bucket = us ? min_t(int, ilog2(us) + 1, XXX_STAT_LAT_BUCKETS - 1) : 0;
+
+	this_cpu_inc(i2c->stats->cnt[XXX_STAT_XFERS]);
+	this_cpu_add(i2c->stats->cnt[XXX_STAT_MSGS], nmsgs);
+	this_cpu_add(i2c->stats->cnt[XXX_STAT_RD_BYTES], rd);
+	this_cpu_add(i2c->stats->cnt[XXX_STAT_WR_BYTES], wr);
+	this_cpu_inc(i2c->stats->lat[size][bucket]);
+}
+
+/* 只统计成功传输的消息的字节数 */
+static void xxx_i2c_stat_msgs(struct xxx_i2c *i2c, struct i2c_msg *msgs,
+			      int num, int ret, u64 ns)
+{
+	unsigned int rd = 0, wr = 0;
+	int i;
+
+	for (i = 0; i < num && i < ret; i++) {
+		if (msgs[i].flags & I2C_M_RD)
+			rd += msgs[i].len;
+		else
+			wr += msgs[i].len;
+	}
+	xxx_i2c_stat_xfer(i2c, max(ret, 0), rd, wr, ns);
+}
+#else
+static inline void xxx_i2c_stat_add(struct xxx_i2c *i2c, enum xxx_i2c_stat id,
+				    unsigned int val) {}
+static inline void xxx_i2c_stat_xfer(struct xxx_i2c *i2c, unsigned int nmsgs,
+				     unsigned int rd, unsigned int wr, u64 ns) {}
+static inline void xxx_i2c_stat_msgs(struct xxx_i2c *i2c, struct i2c_msg *msgs,
+				     int num, int ret, u64 ns) {}
+#endif
+
+static inline void xxx_i2c_stat_inc(struct xxx_i2c *i2c, enum xxx_i2c_stat id)
+{
+	xxx_i2c_stat_add(i2c, id, 1);
+}
+
+/* 环形缓冲区的位置是自由递增的u32，拷贝时按mask回绕 */
+static inline void xxx_i2c_ring_copy_in(u8 *ring, u32 mask, u32 pos,
+					const void *buf, u32 n)
+{
+	u32 off = pos & mask, first = min(n, mask + 1 - off);
+
+	memcpy(ring + off, buf, first);
+	memcpy(ring, buf + first, n - first);
+}
+
+static inline void xxx_i2c_ring_copy_out(void *buf, const u8 *ring, u32 mask,
+					 u32 pos, u32 n)
+{
+	u32 off = pos & mask, first = min(n, mask + 1 - off);
+
+	memcpy(buf, ring + off, first);
+	memcpy(buf + first, ring, n - first);
+}
+
+#if IS_ENABLED(CONFIG_I2C_XXX_TRACE)
+static unsigned int trace_buf_size = SZ_256K;
+module_param(trace_buf_size, uint, 0444);
+MODULE_PARM_DESC(trace_buf_size, "Per-CPU transfer capture buffer in bytes (rounded up to a power of 2)");
+
+/* 传输结束时调用，ns为传输耗时，可以在中断上下文中调用 */
+static void xxx_i2c_trace(struct xxx_i2c *i2c, struct i2c_msg *msgs, int num,
+			  int ret, u64 ns)
+{
+	struct xxx_i2c_trace_buf *tb;
+	struct xxx_i2c_trace_xfer x;
+	struct xxx_i2c_trace_msg m;
+	unsigned long flags;
+	u32 payload, size, pos;
+	int i;
+
+	/* 与开启时的smp_store_release()配对，看到trace_on就能看到缓冲区 */
+	if (!smp_load_acquire(&i2c->trace_on))
+		return;
+
+	payload = READ_ONCE(i2c->trace_payload);
+	size = sizeof(x);
+	for (i = 0; i < num; i++)
+		size += sizeof(m) + min_t(u32, msgs[i].len, payload);
+
+	local_irq_save(flags);
+	tb = *this_cpu_ptr(i2c->trace);
+	pos = tb->head;
+	if (num > U8_MAX ||
+	    size > tb->mask + 1 - (pos - smp_load_acquire(&tb->tail))) {
+		tb->lost++;
+		goto out;
+	}
+
+	x.timestamp = ktime_get_ns() - ns;
+	x.duration = min_t(u64, ns, U32_MAX);
+	x.result = ret;
+	x.nmsgs = num;
+	x.bus = i2c->adap.nr;
+	xxx_i2c_ring_copy_in(tb->data, tb->mask, pos, &x, sizeof(x));
+	pos += sizeof(x);
+
+	for (i = 0; i < num; i++) {
+		m.addr = msgs[i].addr;
+		m.flags = msgs[i].flags;
+		m.len = msgs[i].len;
+		m.data_len = min_t(u32, msgs[i].len, payload);
+		xxx_i2c_ring_copy_in(tb->data, tb->mask, pos, &m, sizeof(m));
+		pos += sizeof(m);
+		xxx_i2c_ring_copy_in(tb->data, tb->mask, pos, msgs[i].buf, m.data_len);
+		pos += m.data_len;
+	}
+	smp_store_release(&tb->head, pos);
+out:
+	local_irq_restore(flags);
+}
+
+/* 硬件序列器执行的SMBus命令按i2c核心模拟时的消息序列记录，
+ * 回放时用I2C_RDWR就能重现 */
+static void xxx_i2c_trace_smbus(struct xxx_i2c *i2c, u16 addr, bool rd,
+				u8 command, int size, const u8 *wbuf,
+				unsigned int wlen, union i2c_smbus_data *data,
+				int ret, u64 ns)
+{
+	u8 w[I2C_SMBUS_BLOCK_MAX + 2];
+	u8 word[2];
+	struct i2c_msg msgs[2] = {
+		{ .addr = addr, .flags = 0, .len = 1, .buf = w },
+		{ .addr = addr, .flags = I2C_M_RD },
+	};
+	int num = rd ? 2 : 1;
+
+	if (!READ_ONCE(i2c->trace_on))
+		return;
+
+	w[0] = command;
+	switch (size) {
+	case I2C_SMBUS_QUICK:
+		msgs[0].flags = rd ? I2C_M_RD : 0;
+		msgs[0].len = 0;
+		num = 1;
+		break;
+	case I2C_SMBUS_BYTE:
+		if (rd) {
+			msgs[0] = msgs[1];
+			msgs[0].len = 1;
+			msgs[0].buf = &data->byte;
+			num = 1;
+		}
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		msgs[1].len = 1;
+		msgs[1].buf = &data->byte;
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		word[0] = data->word & 0xff;
+		word[1] = data->word >> 8;
+		msgs[1].len = 2;
+		msgs[1].buf = word;
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		if (!rd) {
+			w[1] = wlen;
+			msgs[0].len++;
+		}
+		msgs[1].flags |= I2C_M_RECV_LEN;
+		msgs[1].len = ret ? 1 : data->block[0] + 1;
+		msgs[1].buf = data->block;
+		break;
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		msgs[1].len = data->block[0];
+		msgs[1].buf = &data->block[1];
+		break;
+	}
+	if (!rd) {
+		memcpy(&w[msgs[0].len], wbuf, wlen);
+		msgs[0].len += wlen;
+	}
+
+	xxx_i2c_trace(i2c, msgs, num, ret ? ret : num, ns);
+}
+#else
+static inline void xxx_i2c_trace(struct xxx_i2c *i2c, struct i2c_msg *msgs,
+				 int num, int ret, u64 ns) {}
+static inline void xxx_i2c_trace_smbus(struct xxx_i2c *i2c, u16 addr, bool rd,
+				       u8 command, int size, const u8 *wbuf,
+				       unsigned int wlen, union i2c_smbus_data *data,
+				       int ret, u64 ns) {}
+#endif
+
+/* 传输耗时只给统计和抓包（依赖统计）用，没有编译进来时不读时钟 */
+static inline ktime_t xxx_i2c_time_start(void)
+{
+	return IS_ENABLED(CONFIG_I2C_XXX_STATS) ? ktime_get() : 0;
+}
+
+static inline u64 xxx_i2c_time_ns(ktime_t start)
+{
+	if (!IS_ENABLED(CONFIG_I2C_XXX_STATS))
+		return 0;
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/* 不超过freq的最快档位，freq比所有档位都低时用最慢的档位 */
+static unsigned int xxx_i2c_speed_index(struct xxx_i2c *i2c, u32 freq)
+{
+	unsigned int i;
+
+	for (i = i2c->nr_speeds - 1; i > 0; i--)
+		if (i2c->speeds[i].freq <= freq)
+			break;
+
+	return i;
+}
+
+/* 一次传输中所有目标都支持的最快档位，10位地址按适配器默认速度 */
+static unsigned int xxx_i2c_pick_speed(struct xxx_i2c *i2c, struct i2c_msg *msgs,
+				       int num)
+{
+	u32 freq = U32_MAX, f;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_TEN)
+			f = i2c->speeds[i2c->default_speed].freq;
+		else
+			f = READ_ONCE(i2c->addr_freq[msgs[i].addr & 0x7f]);
+		freq = min(freq, f);
+	}
+
+	return xxx_i2c_speed_index(i2c, freq);
+}
+
+/* 在发START之前调用，档位没变时不碰硬件 */
+static inline void xxx_i2c_set_speed(struct xxx_i2c *i2c, unsigned int speed)
+{
+	if (speed != i2c->cur_speed) {
+		i2c_adapter_xxx_set_divider(i2c->speeds[speed].div);
+		i2c->cur_speed = speed;
+		i2c->retimes++;
+	}
+	i2c->speeds[speed].xfers++;
+}
+
+/* bits个位时按speed档位传输的超时时间 */
+static ktime_t xxx_i2c_bits_timeout(struct xxx_i2c *i2c, u64 bits,
+				    unsigned int speed)
+{
+	if (!adaptive_timeout)
+		return ns_to_ktime(jiffies_to_nsecs(i2c->adap.timeout));
+
+	return ns_to_ktime(div_u64(2 * bits * NSEC_PER_SEC, i2c->speeds[speed].freq) +
+			   (u64)stretch_us * NSEC_PER_USEC);
+}
+
+/* 每字节9位（含ACK），每条消息再加START和地址字节，最后一个STOP */
+static ktime_t xxx_i2c_xfer_timeout(struct xxx_i2c *i2c, struct i2c_msg *msgs,
+				    int num, unsigned int speed)
+{
+	u64 bits = 1;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RECV_LEN)
+			bits += (I2C_SMBUS_BLOCK_MAX + 2) * 9 + 1;
+		else
+			bits += (msgs[i].len + 1) * 9 + 1;
+		if (msgs[i].flags & I2C_M_TEN)
+			bits += 9;
+	}
+
+	return xxx_i2c_bits_timeout(i2c, bits, speed);
+}
+
+static void xxx_i2c_dispatch(struct xxx_i2c *i2c);
+
+static void xxx_i2c_account(struct xxx_i2c *i2c, struct xxx_i2c_req *req)
+{
+	struct xxx_i2c_qstats *qs = &i2c->qstats[req->prio];
+	u64 wait = ktime_to_ns(ktime_sub(req->started, req->submitted));
+	u64 service = ktime_to_ns(ktime_sub(ktime_get(), req->started));
+
+	qs->count++;
+	qs->wait_ns += wait;
+	qs->service_ns += service;
+	qs->max_wait_ns = max(qs->max_wait_ns, wait);
+	qs->max_service_ns = max(qs->max_service_ns, service);
+
+	xxx_i2c_stat_msgs(i2c, req->msgs, req->num, req->status, service);
+	xxx_i2c_trace(i2c, req->msgs, req->num, req->status, service);
+}
+
+/* DMA方式下出错结束：DMA通道可能还在搬运，先停掉控制器的DMA请求，
+ * 终止通道和解除映射要睡眠，交给timeout_work在通道停下来之后结束请求 */
+static void xxx_i2c_dma_error(struct xxx_i2c *i2c, int ret)
+{
+	i2c_adapter_xxx_disable_dma();
+	i2c->stall_status = ret;
+	hrtimer_try_to_cancel(&i2c->timer);
+	schedule_work(&i2c->timeout_work);
+}
+
+/* 结束当前请求并开始下一个，ret非0时作为传输的返回值，调用者持有i2c->lock。
+ * 完成的请求挂到done上，由xxx_i2c_run_completions()在锁外调用回调。
+ * DMA方式下出错时通道还没停，既不能解除映射也不能在通道上开始下一个
+ * 请求，改由timeout_work结束。 */
+static inline void xxx_i2c_master_complete(struct xxx_i2c *i2c, int ret)
+{
+	struct xxx_i2c_req *req = i2c->cur;
+
+	if (ret && i2c->mode == XXX_XFER_DMA) {
+		xxx_i2c_dma_error(i2c, ret);
+		return;
+	}
+
+	i2c->msg_ptr = 0;
+	i2c->msg = NULL;
+	i2c->msg_idx++;
+	i2c->msg_num = 0;
+	if (ret)
+		i2c->msg_idx = ret;
+
+	hrtimer_try_to_cancel(&i2c->timer);
+	req->status = i2c->msg_idx;
+	xxx_i2c_account(i2c, req);
+	list_add_tail(&req->node, &i2c->done);
+	i2c->cur = NULL;
+	i2c->dma = NULL;
+
+	/* 不回到进程上下文，直接在本次中断里开始下一个请求 */
+	xxx_i2c_dispatch(i2c);
+}
+
+static inline void xxx_i2c_stop(struct xxx_i2c *i2c, int ret)
+{
+	i2c_adapter_xxx_stop(); /* 产生停止位 */
+	i2c->state = STATE_STOP;
+	i2c_adapter_xxx_disable_irq();
+	xxx_i2c_master_complete(i2c, ret);
+}
+
+/* 为一条消息产生START（或重复START）并发送地址，地址阶段结束后产生中断 */
+static void xxx_i2c_message_start(struct xxx_i2c *i2c, struct i2c_msg *msg)
+{
+	unsigned int addr = (msg->addr & 0x7f) << 1;
+
+	if (msg->flags & I2C_M_RD)
+		addr |= 1;
+	if (msg->flags & I2C_M_REV_DIR_ADDR)
+		addr ^= 1;
+
+	i2c_adapter_xxx_enable_irq();
+	i2c_adapter_xxx_start(); /* 产生开始位 */
+	i2c_adapter_xxx_setaddr(addr); /* 发送从设备地址 */
+}
+
+static enum xxx_i2c_prio xxx_i2c_pick_class(struct xxx_i2c *i2c)
+{
+	bool high = !list_empty(&i2c->queue[XXX_PRIO_HIGH]);
+	bool bulk = !list_empty(&i2c->queue[XXX_PRIO_BULK]);
+
+	if (high && (!bulk || i2c->high_streak < XXX_I2C_HIGH_BURST)) {
+		i2c->high_streak++;
+		return XXX_PRIO_HIGH;
+	}
+	i2c->high_streak = 0;
+
+	return bulk ? XXX_PRIO_BULK : XXX_PRIO_NR;
+}
+
+/* 控制器空闲时从队列中取出下一个请求并发出START，调用者持有i2c->lock。
+ * 本机的请求由队列串行化，只有控制器空闲时总线仍忙才说明有其他主机
+ * 在传输，这时请求以-EAGAIN结束（挂到done上），i2c_transfer()的同步
+ * 传输由i2c核心按adap.retries重试。调用者之后要调用
+ * xxx_i2c_run_completions()。 */
+static void xxx_i2c_dispatch(struct xxx_i2c *i2c)
+{
+	struct xxx_i2c_req *req;
+	enum xxx_i2c_prio prio;
+
+	if (i2c->cur || i2c->smbus_active)
+		return;
+
+	for (;;) {
+		prio = xxx_i2c_pick_class(i2c);
+		if (prio == XXX_PRIO_NR) {
+			i2c->state = STATE_IDLE;
+			return;
+		}
+
+		req = list_first_entry(&i2c->queue[prio], struct xxx_i2c_req, node);
+		list_del(&req->node);
+		i2c->qstats[prio].depth--;
+		req->started = ktime_get();
+
+		if (!i2c_adapter_xxx_bus_busy()) /* 总线没有被其他主机占用 */
+			break;
+		req->status = -EAGAIN;
+		xxx_i2c_account(i2c, req);
+		list_add_tail(&req->node, &i2c->done);
+	}
+
+	i2c->cur = req;
+	i2c->dma = req->dma;
+	i2c->msg = req->msgs;
+	i2c->msg_ptr = 0;
+	i2c->msg_idx = 0;
+	i2c->msg_num = req->num;
+	i2c->mode = XXX_XFER_PIO;	/* 数据阶段开始时再按消息选择 */
+	i2c->state = STATE_START;
+	i2c->progress = req->started;
+	i2c->deadline = ktime_add(req->started,
+				  xxx_i2c_xfer_timeout(i2c, req->msgs, req->num, req->speed));
+	hrtimer_start(&i2c->timer, i2c->deadline, HRTIMER_MODE_ABS);
+	xxx_i2c_set_speed(i2c, req->speed);
+	xxx_i2c_message_start(i2c, req->msgs);
+}
+
+static const struct i2c_algorithm xxx_i2c_algorithm;
+static void xxx_i2c_dma_callback(void *data);
+static void xxx_i2c_run_completions(struct xxx_i2c *i2c);
+
+/* 按长度为当前消息选择搬运方式 */
+static enum xxx_i2c_xfer_mode xxx_i2c_select_mode(struct xxx_i2c *i2c)
+{
+	struct i2c_msg *msg = i2c->msg;
+
+	/* SMBus块读要先收到长度字节才知道消息多长，只能逐字节 */
+	if (msg->flags & I2C_M_RECV_LEN)
+		return XXX_XFER_PIO;
+	if (i2c->dma && i2c->dma[i2c->msg_idx].buf)
+		return XXX_XFER_DMA;
+	if (msg->len >= i2c->fifo_threshold)
+		return XXX_XFER_FIFO;
+
+	return XXX_XFER_PIO;
+}
+
+/* 缓冲区已在xxx_i2c_dma_prepare()中映射好，这里只提交描述符，可在中断中调用 */
+static int xxx_i2c_dma_start(struct xxx_i2c *i2c)
+{
+	struct i2c_msg *msg = i2c->msg;
+	bool rd = msg->flags & I2C_M_RD;
+	struct dma_chan *chan = rd ? i2c->dma_rx : i2c->dma_tx;
+	struct dma_async_tx_descriptor *desc;
+
+	desc = dmaengine_prep_slave_single(chan, i2c->dma[i2c->msg_idx].addr,
+					   msg->len,
+					   rd ? DMA_DEV_TO_MEM : DMA_MEM_TO_DEV,
+					   DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!desc)
+		return -EIO;
+
+	desc->callback = xxx_i2c_dma_callback;
+	desc->callback_param = i2c;
+	dmaengine_submit(desc);
+	i2c_adapter_xxx_enable_dma(msg->len, rd); /* 控制器按DMA请求搬运len字节 */
+	dma_async_issue_pending(chan);
+
+	return 0;
+}
+
+/* 写消息：PIO写1个字节，FIFO一次填满发送FIFO */
+static void xxx_i2c_write_more(struct xxx_i2c *i2c)
+{
+	unsigned int n = 1;
+
+	if (i2c->mode == XXX_XFER_FIFO)
+		n = min_t(unsigned int, i2c->msg->len - i2c->msg_ptr,
+			  XXX_I2C_FIFO_DEPTH);
+
+	i2c_adapter_xxx_write_fifo(&i2c->msg->buf[i2c->msg_ptr], n);
+	i2c->msg_ptr += n;
+}
+
+/* 读消息：启动下一批字节的接收，本条消息的最后一个字节回NAK */
+static void xxx_i2c_read_more(struct xxx_i2c *i2c)
+{
+	struct i2c_msg *msg = i2c->msg;
+	unsigned int n = 1;
+	bool last;
+
+	if (i2c->mode == XXX_XFER_FIFO)
+		n = min_t(unsigned int, msg->len - i2c->msg_ptr,
+			  XXX_I2C_FIFO_DEPTH);
+
+	/* SMBus块读的长度字节要ACK，收到之后len才是真正的长度 */
+	last = i2c->msg_ptr + n == msg->len &&
+	       !((msg->flags & I2C_M_RECV_LEN) && msg->len == 1);
+	i2c_adapter_xxx_trigger_read(n, last);
+}
+
+/* 地址阶段结束（或I2C_M_NOSTART时直接）开始当前消息的数据阶段 */
+static void xxx_i2c_msg_begin(struct xxx_i2c *i2c)
+{
+	i2c->mode = xxx_i2c_select_mode(i2c);
+	i2c->dma_done = false;
+	i2c->tx_done = false;
+	if (i2c->mode == XXX_XFER_DMA && xxx_i2c_dma_start(i2c))
+		i2c->mode = XXX_XFER_FIFO; /* 描述符申请失败就退回FIFO */
+	i2c->mode_hits[i2c->mode]++;
+
+	if (i2c->msg->flags & I2C_M_RD) {
+		i2c->state = STATE_READ;
+		if (i2c->mode != XXX_XFER_DMA)
+			xxx_i2c_read_more(i2c);
+	} else {
+		i2c->state = STATE_WRITE;
+		if (i2c->mode != XXX_XFER_DMA)
+			xxx_i2c_write_more(i2c);
+	}
+}
+
+/* 当前消息的数据已全部传完，进入下一条消息或结束传输 */
+static void xxx_i2c_msg_done(struct xxx_i2c *i2c)
+{
+	if (is_lastmsg(i2c)) {
+		xxx_i2c_stop(i2c, 0);
+		return;
+	}
+
+	i2c->msg_ptr = 0;
+	i2c->msg_idx++;
+	i2c->msg++;
+
+	/* I2C_M_NOSTART：不发START和地址，直接接着写下一条消息的数据 */
+	if (i2c->msg->flags & I2C_M_NOSTART) {
+		if (i2c->msg->flags & I2C_M_RD) {
+			/* 不发START无法改变传输方向 */
+			xxx_i2c_stop(i2c, -EINVAL);
+			return;
+		}
+		xxx_i2c_msg_begin(i2c);
+		return;
+	}
+
+	/* 消息之间用重复START衔接 */
+	i2c->state = STATE_START;
+	xxx_i2c_message_start(i2c, i2c->msg);
+}
+
+static void xxx_i2c_dma_callback(void *data)
+{
+	struct xxx_i2c *i2c = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&i2c->lock, flags);
+	if (i2c->state != STATE_READ && i2c->state != STATE_WRITE) {
+		/* 已经超时结束了 */
+		spin_unlock_irqrestore(&i2c->lock, flags);
+		return;
+	}
+
+	i2c_adapter_xxx_disable_dma();
+	i2c->msg_ptr = i2c->msg->len;
+	i2c->dma_done = true;
+	/* 读消息数据已全部到内存；写消息还要等控制器发完最后一个字节的中断，
+	 * 中断已经先到了就在这里结束 */
+	if (i2c->state == STATE_READ || i2c->tx_done)
+		xxx_i2c_msg_done(i2c);
+	spin_unlock_irqrestore(&i2c->lock, flags);
+
+	xxx_i2c_run_completions(i2c);
+}
+
+/* 在中断中推进状态机，调用者持有i2c->lock */
+static void xxx_i2c_irq_nextbyte(struct xxx_i2c *i2c, unsigned long status)
+{
+	unsigned int n;
+
+	switch (i2c->state) {
+	case STATE_IDLE:
+		dev_err(&i2c->adap.dev, "%s: called in STATE_IDLE\n", __func__);
+		return;
+
+	case STATE_STOP:
+		dev_err(&i2c->adap.dev, "%s: called in STATE_STOP\n", __func__);
+		i2c_adapter_xxx_disable_irq();
+		return;
+
+	case STATE_START:
+		/* 地址阶段结束，检查从设备是否应答 */
+		if ((status & XXX_I2C_STAT_NAK) &&
+		    !(i2c->msg->flags & I2C_M_IGNORE_NAK)) {
+			dev_dbg(&i2c->adap.dev, "ack was not received\n");
+			xxx_i2c_stat_inc(i2c, XXX_STAT_NAKS);
+			xxx_i2c_stop(i2c, -ENXIO);
+			return;
+		}
+
+		/* 0长度消息（如SMBus quick命令）地址阶段后就结束了 */
+		if (i2c->msg->len == 0) {
+			xxx_i2c_msg_done(i2c);
+			return;
+		}
+		xxx_i2c_msg_begin(i2c);
+		break;
+
+	case STATE_WRITE:
+		if ((status & XXX_I2C_STAT_NAK) &&
+		    !(i2c->msg->flags & I2C_M_IGNORE_NAK)) {
+			dev_dbg(&i2c->adap.dev, "WRITE: No Ack\n");
+			xxx_i2c_stat_inc(i2c, XXX_STAT_NAKS);
+			xxx_i2c_stop(i2c, -ECONNREFUSED);
+			return;
+		}
+		/* DMA写期间控制器不产生字节中断，这就是最后的发送完成中断，
+		 * DMA完成回调还没到时留给它结束消息 */
+		if (i2c->mode == XXX_XFER_DMA) {
+			i2c->tx_done = true;
+			if (i2c->dma_done)
+				xxx_i2c_msg_done(i2c);
+			return;
+		}
+		if (is_msgend(i2c))
+			xxx_i2c_msg_done(i2c);
+		else
+			xxx_i2c_write_more(i2c);
+		break;
+
+	case STATE_READ:
+		if (i2c->mode == XXX_XFER_DMA)
+			return;
+
+		/* 取出接收FIFO中已有的数据，PIO时就是1个字节 */
+		n = i2c_adapter_xxx_read_fifo(&i2c->msg->buf[i2c->msg_ptr],
+					      i2c->msg->len - i2c->msg_ptr);
+		i2c->msg_ptr += n;
+
+		/* SMBus块读，第一个字节是后续数据的长度 */
+		if ((i2c->msg->flags & I2C_M_RECV_LEN) && i2c->msg->len == 1) {
+			if (i2c->msg->buf[0] == 0 ||
+			    i2c->msg->buf[0] > I2C_SMBUS_BLOCK_MAX) {
+				xxx_i2c_stop(i2c, -EPROTO);
+				return;
+			}
+			i2c->msg->len += i2c->msg->buf[0];
+		}
+
+		if (is_msgend(i2c))
+			xxx_i2c_msg_done(i2c);
+		else
+			xxx_i2c_read_more(i2c);
+		break;
+	}
+}
+
+/* 序列器执行完整条SMBus命令后才产生中断，调用者持有i2c->lock */
+static void xxx_i2c_smbus_irq(struct xxx_i2c *i2c, unsigned long status)
+{
+	if (status & XXX_I2C_STAT_ARB_LOST) {
+		xxx_i2c_stat_inc(i2c, XXX_STAT_ARB_LOST);
+		i2c->smbus_status = -EAGAIN;
+	} else if (status & XXX_I2C_STAT_NAK) {
+		xxx_i2c_stat_inc(i2c, XXX_STAT_NAKS);
+		i2c->smbus_status = -ENXIO;
+	} else if (status & XXX_I2C_STAT_BUS_STUCK)
+		i2c->smbus_status = -EBUSY;
+	else if (status & XXX_I2C_STAT_PEC_ERR)
+		i2c->smbus_status = -EBADMSG;
+	else if (status & XXX_I2C_STAT_SMBUS_DONE)
+		i2c->smbus_status = 0;
+	else
+		return;
+
+	i2c->state = STATE_STOP;
+	i2c_adapter_xxx_disable_irq();
+	wake_up(&i2c->wait);
+}
+
+#if IS_ENABLED(CONFIG_I2C_SLAVE)
+/* slave模式
+ * 适配器作为i2c目标设备被其他主机（如板上的管理控制器）访问时，
+ * i2c核心的通用接口是i2c_slave_register()注册的slave_cb，每收发
+ * 一个字节回调一次。xxx适配器对任何slave后端都按FIFO成批取出/填入
+ * 数据，再逐字节转换成I2C_SLAVE_*事件；对于本文件中的"xxx-slave"
+ * 环形缓冲区后端则跳过逐字节回调，每次中断把整批数据直接拷入/拷出
+ * 与用户空间共享的环形缓冲区。"xxx-slave"后端只依赖slave_cb，
+ * 挂在其他适配器上时退回逐字节方式。
+ *
+ * 硬件相关的slave中断位：
+ * XXX_I2C_STAT_SLAVE_WR_REQ: 本机地址被匹配，主机要写
+ * XXX_I2C_STAT_SLAVE_RD_REQ: 本机地址被匹配，主机要读
+ * XXX_I2C_STAT_SLAVE_RX:     接收FIFO达到水位
+ * XXX_I2C_STAT_SLAVE_TX:     发送FIFO低于水位，主机还在读
+ * XXX_I2C_STAT_SLAVE_STOP:   检测到STOP
+ * XXX_I2C_STAT_SLAVE为以上各位之和 */
+#define XXX_SLAVE_ALIGN		16	/* 帧按16字节对齐，帧头不会跨越环的末尾 */
+#define XXX_SLAVE_LAT_BUCKETS	16
+
+static unsigned int slave_ring_size = SZ_64K;
+module_param(slave_ring_size, uint, 0444);
+MODULE_PARM_DESC(slave_ring_size, "Size in bytes of each xxx-slave ring (rounded up to a power of 2)");
+
+/* 映射的第一页，rx/tx数据区的偏移相对于映射起点。位置都是自由递增的
+ * u32，与环大小-1相与后才是下标。每个字段只有一个写者：rx_head、
+ * tx_tail及计数器由中断更新，rx_tail、tx_head由read()/write()或者
+ * mmap的用户程序更新（二者不能同时使用）。写者先写数据、再以release
+ * 语义更新位置，读者以acquire语义读位置，全程不加锁。
+ * 整页对用户可写，内核自己的位置另存在struct xxx_slave中，头部里的
+ * 只是副本；从头部读回的rx_tail、tx_head只用来算空间，用前检查范围。 */
+struct xxx_slave_ring_hdr {
+	__u32 rx_head;
+	__u32 rx_tail;
+	__u32 tx_head;
+	__u32 tx_tail;
+	__u32 rx_offset;
+	__u32 rx_size;
+	__u32 tx_offset;
+	__u32 tx_size;
+	__u64 rx_frames;
+	__u64 rx_bytes;
+	__u64 rx_dropped;	/* 接收环满时丢弃的字节数 */
+	__u64 tx_bytes;
+	__u64 tx_underrun;	/* 主机来读时发送环已空，补发0xff的字节数 */
+	__u64 fifo_chunks;	/* 成批搬运FIFO的次数 */
+};
+
+/* 接收环中每次写传输（到STOP或重复START为止）是一帧：帧头之后是
+ * len字节数据，整帧按XXX_SLAVE_ALIGN对齐 */
+struct xxx_slave_frame {
+	__u32 len;
+	__u32 flags;
+#define XXX_SLAVE_FRAME_TRUNC	0x1	/* 接收环满，帧尾被丢弃 */
+	__u64 timestamp;	/* 帧结束时的ktime_get_ns() */
+};
+
+struct xxx_slave {
+	struct i2c_client *client;
+	/* probe持有一个引用，每个打开的fd各一个，最后一个引用放掉时
+	 * 才释放环和本结构，remove之后fd上的操作都返回-ENODEV */
+	struct kref ref;
+	bool removed;
+	struct xxx_slave_ring_hdr *hdr;	/* vmalloc_user()，整块映射给用户 */
+	u8 *rx;
+	u8 *tx;
+	u32 rx_mask;
+	u32 tx_mask;
+
+	/* 内核自己的位置，更新后再发布到头部 */
+	u32 rx_head;		/* 中断写 */
+	u32 tx_tail;		/* 中断写 */
+	u32 rx_tail;		/* read()写，持有read_lock */
+	u32 tx_head;		/* write()写，持有write_lock */
+
+	/* 以下字段只在中断（或slave_cb）中访问 */
+	bool in_frame;
+	bool frame_dropped;	/* 连帧头都放不下，整帧丢弃 */
+	u32 frame_start;	/* 当前帧帧头的位置 */
+	u32 rx_pos;		/* 当前帧写到的位置，帧结束时才发布为rx_head */
+	u32 frame_flags;
+	bool in_read;
+	u32 tx_pos;		/* 已交给FIFO的位置，确认发出后才发布为tx_tail */
+	u32 tx_pad;		/* 交给FIFO的0xff补位字节数，总在环中数据之后 */
+
+	/* 经read()取走的帧从接收完成到被取走的延迟，按log2(us)分组 */
+	u64 lat[XXX_SLAVE_LAT_BUCKETS];
+	u64 lat_max_ns;
+
+	wait_queue_head_t wait;
+	struct mutex read_lock;
+	struct mutex write_lock;
+	struct miscdevice miscdev;
+	char miscname[32];
+};
+
+/* 主机开始一次写传输，为帧头预留位置 */
+static void xxx_slave_rx_begin(struct xxx_slave *s)
+{
+	u32 tail = smp_load_acquire(&s->hdr->rx_tail);
+
+	s->in_frame = true;
+	s->frame_flags = 0;
+	s->frame_start = s->rx_head;
+	s->rx_pos = s->frame_start + sizeof(struct xxx_slave_frame);
+	s->frame_dropped = s->rx_pos - tail > s->rx_mask + 1;
+}
+
+static void xxx_slave_rx_put(struct xxx_slave *s, const u8 *buf, u32 n)
+{
+	u32 used, room;
+
+	if (!s->in_frame)
+		xxx_slave_rx_begin(s);
+	if (s->frame_dropped) {
+		s->hdr->rx_dropped += n;
+		return;
+	}
+
+	/* tail和环大小都是XXX_SLAVE_ALIGN的整数倍，写到tail+size为止，
+	 * 对齐之后的帧尾也不会覆盖未取走的数据 */
+	used = s->rx_pos - smp_load_acquire(&s->hdr->rx_tail);
+	room = used > s->rx_mask + 1 ? 0 : s->rx_mask + 1 - used;
+	if (n > room) {
+		s->hdr->rx_dropped += n - room;
+		s->frame_flags |= XXX_SLAVE_FRAME_TRUNC;
+		n = room;
+	}
+	xxx_i2c_ring_copy_in(s->rx, s->rx_mask, s->rx_pos, buf, n);
+	s->rx_pos += n;
+	s->hdr->rx_bytes += n;
+}
+
+/* 写传输结束，填写帧头并把整帧发布给消费者 */
+static void xxx_slave_rx_end(struct xxx_slave *s)
+{
+	struct xxx_slave_frame f;
+
+	if (!s->in_frame)
+		return;
+	s->in_frame = false;
+	if (s->frame_dropped)
+		return;
+
+	f.len = s->rx_pos - s->frame_start - sizeof(f);
+	f.flags = s->frame_flags;
+	f.timestamp = ktime_get_ns();
+	xxx_i2c_ring_copy_in(s->rx, s->rx_mask, s->frame_start, &f, sizeof(f));
+	s->hdr->rx_frames++;
+	smp_store_release(&s->rx_head, ALIGN(s->rx_pos, XXX_SLAVE_ALIGN));
+	smp_store_release(&s->hdr->rx_head, s->rx_head);
+	wake_up_interruptible(&s->wait);
+}
+
+/* 主机开始一次读传输 */
+static void xxx_slave_tx_begin(struct xxx_slave *s)
+{
+	s->in_read = true;
+	s->tx_pos = s->tx_tail;
+	s->tx_pad = 0;
+}
+
+/* 从发送环取最多room个字节，环空之后本次传输剩下的部分一律补0xff */
+static u32 xxx_slave_tx_get(struct xxx_slave *s, u8 *buf, u32 room)
+{
+	u32 avail = smp_load_acquire(&s->hdr->tx_head) - s->tx_pos;
+	u32 n;
+
+	if (s->tx_pad || avail == 0 || avail > s->tx_mask + 1) {
+		memset(buf, 0xff, room);
+		s->tx_pad += room;
+		return room;
+	}
+
+	n = min(avail, room);
+	xxx_i2c_ring_copy_out(buf, s->tx, s->tx_mask, s->tx_pos, n);
+	s->tx_pos += n;
+
+	return n;
+}
+
+/* 读传输结束，unsent是留在FIFO中没有发出去的字节数，
+ * 其中属于发送环的部分留给下一次读 */
+static void xxx_slave_tx_end(struct xxx_slave *s, u32 unsent)
+{
+	u32 pad_unsent, sent;
+
+	if (!s->in_read)
+		return;
+	s->in_read = false;
+
+	pad_unsent = min(unsent, s->tx_pad);
+	sent = s->tx_pos - s->tx_tail - (unsent - pad_unsent);
+
+	s->hdr->tx_bytes += sent;
+	s->hdr->tx_underrun += s->tx_pad - pad_unsent;
+	smp_store_release(&s->tx_tail, s->tx_tail + sent);
+	smp_store_release(&s->hdr->tx_tail, s->tx_tail);
+	wake_up_interruptible(&s->wait);
+}
+
+/* 通用的逐字节接口，"xxx-slave"挂在其他适配器上时使用。
+ * READ_PROCESSED表示上一个字节已被主机ACK，最后提供的字节不一定发出，
+ * 所以STOP时按1个未发出的字节结算 */
+static int xxx_slave_cb(struct i2c_client *client, enum i2c_slave_event event,
+			u8 *val)
+{
+	struct xxx_slave *s = i2c_get_clientdata(client);
+
+	switch (event) {
+	case I2C_SLAVE_WRITE_REQUESTED:
+		xxx_slave_rx_end(s);
+		xxx_slave_tx_end(s, 1);
+		xxx_slave_rx_begin(s);
+		break;
+	case I2C_SLAVE_WRITE_RECEIVED:
+		xxx_slave_rx_put(s, val, 1);
+		break;
+	case I2C_SLAVE_READ_REQUESTED:
+		xxx_slave_rx_end(s);
+		xxx_slave_tx_end(s, 1);
+		xxx_slave_tx_begin(s);
+		xxx_slave_tx_get(s, val, 1);
+		break;
+	case I2C_SLAVE_READ_PROCESSED:
+		xxx_slave_tx_get(s, val, 1);
+		break;
+	case I2C_SLAVE_STOP:
+		xxx_slave_rx_end(s);
+		xxx_slave_tx_end(s, 1);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/* "xxx-slave"后端：整批数据直接进出环形缓冲区 */
+static void xxx_i2c_slave_ring_irq(struct xxx_slave *s, unsigned long status)
+{
+	u8 buf[XXX_I2C_FIFO_DEPTH];
+	u32 n;
+
+	/* 新的写传输开始，之后取出的数据属于新的一帧 */
+	if (status & XXX_I2C_STAT_SLAVE_WR_REQ) {
+		xxx_slave_rx_end(s);
+		xxx_slave_tx_end(s, i2c_adapter_xxx_slave_tx_flush());
+		xxx_slave_rx_begin(s);
+	}
+
+	while ((n = i2c_adapter_xxx_slave_read_fifo(buf, sizeof(buf))) > 0) {
+		xxx_slave_rx_put(s, buf, n);
+		s->hdr->fifo_chunks++;
+	}
+
+	/* 写寄存器地址后重复START读：前面的写传输到此为止 */
+	if (status & XXX_I2C_STAT_SLAVE_RD_REQ) {
+		xxx_slave_rx_end(s);
+		xxx_slave_tx_end(s, i2c_adapter_xxx_slave_tx_flush());
+		xxx_slave_tx_begin(s);
+	}
+
+	if (s->in_read && (status & (XXX_I2C_STAT_SLAVE_RD_REQ | XXX_I2C_STAT_SLAVE_TX))) {
+		n = min_t(u32, i2c_adapter_xxx_slave_tx_room(), sizeof(buf));
+		if (n) {
+			n = xxx_slave_tx_get(s, buf, n);
+			i2c_adapter_xxx_slave_write_fifo(buf, n);
+			s->hdr->fifo_chunks++;
+		}
+	}
+
+	if (status & XXX_I2C_STAT_SLAVE_STOP) {
+		xxx_slave_rx_end(s);
+		xxx_slave_tx_end(s, i2c_adapter_xxx_slave_tx_flush());
+	}
+}
+
+/* 其他slave后端：FIFO仍然成批搬运，逐字节转换成I2C_SLAVE_*事件 */
+static void xxx_i2c_slave_event_irq(struct i2c_client *client, unsigned long status)
+{
+	u8 buf[XXX_I2C_FIFO_DEPTH];
+	u32 n, i;
+	u8 val;
+
+	if (status & XXX_I2C_STAT_SLAVE_WR_REQ)
+		i2c_slave_event(client, I2C_SLAVE_WRITE_REQUESTED, &val);
+
+	while ((n = i2c_adapter_xxx_slave_read_fifo(buf, sizeof(buf))) > 0)
+		for (i = 0; i < n; i++)
+			i2c_slave_event(client, I2C_SLAVE_WRITE_RECEIVED, &buf[i]);
+
+	if (status & XXX_I2C_STAT_SLAVE_RD_REQ) {
+		i2c_slave_event(client, I2C_SLAVE_READ_REQUESTED, &val);
+		i2c_adapter_xxx_slave_write_fifo(&val, 1);
+	} else if (status & XXX_I2C_STAT_SLAVE_TX) {
+		i2c_slave_event(client, I2C_SLAVE_READ_PROCESSED, &val);
+		i2c_adapter_xxx_slave_write_fifo(&val, 1);
+	}
+
+	if (status & XXX_I2C_STAT_SLAVE_STOP) {
+		i2c_adapter_xxx_slave_tx_flush();
+		i2c_slave_event(client, I2C_SLAVE_STOP, &val);
+	}
+}
+
+/* 处理slave相关的中断位，返回剩下的主机模式状态位。
+ * slave的状态只在中断中访问，不需要i2c->lock */
+static unsigned long xxx_i2c_slave_irq(struct xxx_i2c *i2c, unsigned long status)
+{
+	struct i2c_client *client = READ_ONCE(i2c->slave);
+
+	if (client && (status & XXX_I2C_STAT_SLAVE)) {
+		if (client->slave_cb == xxx_slave_cb)
+			xxx_i2c_slave_ring_irq(i2c_get_clientdata(client), status);
+		else
+			xxx_i2c_slave_event_irq(client, status);
+	}
+
+	return status & ~XXX_I2C_STAT_SLAVE;
+}
+
+static int xxx_i2c_reg_slave(struct i2c_client *slave)
+{
+	struct xxx_i2c *i2c = i2c_get_adapdata(slave->adapter);
+
+	/* slave模式完全由中断驱动 */
+	if (i2c->irq < 0)
+		return -EOPNOTSUPP;
+	if (i2c->slave)
+		return -EBUSY;
+
+	WRITE_ONCE(i2c->slave, slave);
+	i2c_adapter_xxx_slave_enable(slave->addr, slave->flags & I2C_CLIENT_TEN);
+
+	return 0;
+}
+
+static int xxx_i2c_unreg_slave(struct i2c_client *slave)
+{
+	struct xxx_i2c *i2c = i2c_get_adapdata(slave->adapter);
+
+	i2c_adapter_xxx_slave_disable();
+	/* 等正在执行的中断处理结束，之后不会再访问slave */
+	synchronize_irq(i2c->irq);
+	WRITE_ONCE(i2c->slave, NULL);
+
+	return 0;
+}
+#else
+static inline unsigned long xxx_i2c_slave_irq(struct xxx_i2c *i2c,
+					      unsigned long status)
+{
+	return status;
+}
+#endif
+
+static irqreturn_t xxx_i2c_irq(int irqno, void *dev_id)
+{
+	struct xxx_i2c *i2c = dev_id;
+	unsigned long status;
+
+	status = i2c_adapter_xxx_status(); /* 读取并清除中断状态 */
+
+	/* 作为slave被访问的中断与本机作为主机的传输互不相干，先处理掉 */
+	status = xxx_i2c_slave_irq(i2c, status);
+	if (!status)
+		return IRQ_HANDLED;
+
+	spin_lock(&i2c->lock);
+	if (i2c->state == STATE_IDLE ||
+	    (!i2c->cur && i2c->state != STATE_SMBUS)) {
+		/* 超时后才到来的迟到中断，或SMBus命令结束后的多余中断，直接忽略 */
+		spin_unlock(&i2c->lock);
+		return IRQ_HANDLED;
+	}
+
+	if (i2c->state == STATE_SMBUS) {
+		xxx_i2c_smbus_irq(i2c, status);
+	} else if (status & XXX_I2C_STAT_BUS_STUCK) {
+		/* SCL或SDA被拉低，不等超时，交给超时处理去恢复总线 */
+		dev_dbg(&i2c->adap.dev, "bus stuck\n");
+		i2c->state = STATE_STOP;
+		i2c_adapter_xxx_disable_irq();
+		i2c->stall_status = -EBUSY;
+		hrtimer_try_to_cancel(&i2c->timer);
+		schedule_work(&i2c->timeout_work);
+	} else if (status & XXX_I2C_STAT_ARB_LOST) {
+		/* 仲裁失败，控制器已释放总线，交给i2c核心按adap.retries重试 */
+		dev_dbg(&i2c->adap.dev, "arbitration lost\n");
+		xxx_i2c_stat_inc(i2c, XXX_STAT_ARB_LOST);
+		i2c->state = STATE_STOP;
+		i2c_adapter_xxx_disable_irq();
+		xxx_i2c_master_complete(i2c, -EAGAIN);
+	} else {
+		i2c->progress = ktime_get();
+		xxx_i2c_irq_nextbyte(i2c, status);
+	}
+	spin_unlock(&i2c->lock);
+
+	xxx_i2c_run_completions(i2c);
+
+	return IRQ_HANDLED;
+}
+
+/* 在进程上下文中为长度达到dma_threshold的消息准备DMA安全的缓冲区并映射，
+ * 调用者的buf不一定能做DMA（如在栈上），必要时换成bounce buffer。
+ * 准备失败的消息在中断里会退回FIFO方式。 */
+static struct xxx_i2c_dma_buf *xxx_i2c_dma_prepare(struct xxx_i2c *i2c,
+						   struct i2c_msg *msgs, int num)
+{
+	struct xxx_i2c_dma_buf *dma;
+	struct dma_chan *chan;
+	int i;
+
+	if (!i2c->dma_tx || !i2c->dma_rx)
+		return NULL;
+
+	for (i = 0; i < num; i++)
+		if (msgs[i].len >= i2c->dma_threshold)
+			break;
+	if (i == num)
+		return NULL;
+
+	dma = kcalloc(num, sizeof(*dma), GFP_KERNEL);
+	if (!dma)
+		return NULL;
+
+	for (; i < num; i++) {
+		if (msgs[i].len < i2c->dma_threshold ||
+		    (msgs[i].flags & I2C_M_RECV_LEN))
+			continue;
+
+		chan = msgs[i].flags & I2C_M_RD ? i2c->dma_rx : i2c->dma_tx;
+		dma[i].buf = i2c_get_dma_safe_msg_buf(&msgs[i], i2c->dma_threshold);
+		if (!dma[i].buf)
+			continue;
+
+		dma[i].addr = dma_map_single(chan->device->dev, dma[i].buf,
+					     msgs[i].len,
+					     msgs[i].flags & I2C_M_RD ?
+					     DMA_FROM_DEVICE : DMA_TO_DEVICE);
+		if (dma_mapping_error(chan->device->dev, dma[i].addr)) {
+			i2c_put_dma_safe_msg_buf(dma[i].buf, &msgs[i], false);
+			dma[i].buf = NULL;
+		}
+	}
+
+	return dma;
+}
+
+/* 解除映射，读消息把bounce buffer中的数据拷回调用者的buf，
+ * 不会睡眠，可以在中断中调用 */
+static void xxx_i2c_dma_release(struct xxx_i2c *i2c, struct xxx_i2c_req *req,
+				bool xferred)
+{
+	struct i2c_msg *msgs = req->msgs;
+	struct dma_chan *chan;
+	int i;
+
+	if (!req->dma)
+		return;
+
+	for (i = 0; i < req->num; i++) {
+		if (!req->dma[i].buf)
+			continue;
+		chan = msgs[i].flags & I2C_M_RD ? i2c->dma_rx : i2c->dma_tx;
+		dma_unmap_single(chan->device->dev, req->dma[i].addr, msgs[i].len,
+				 msgs[i].flags & I2C_M_RD ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+		i2c_put_dma_safe_msg_buf(req->dma[i].buf, &msgs[i], xferred);
+	}
+
+	kfree(req->dma);
+	req->dma = NULL;
+}
+
+/* 在锁外调用已完成请求的回调。调用者可能是硬中断、DMA完成回调、
+ * 工作队列或提交者，回调按原子上下文对待：不能睡眠，也不能调用xxx_i2c_submit()
+ * （它要准备DMA缓冲区，可能睡眠），需要接着传输的应交给自己的工作队列 */
+static void xxx_i2c_run_completions(struct xxx_i2c *i2c)
+{
+	struct xxx_i2c_req *req, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&i2c->lock, flags);
+	list_splice_init(&i2c->done, &done);
+	spin_unlock_irqrestore(&i2c->lock, flags);
+
+	list_for_each_entry_safe(req, tmp, &done, node) {
+		list_del(&req->node);
+		if (req->status != req->num)
+			dev_dbg(&i2c->adap.dev, "incomplete xfer (%d)\n", req->status);
+		xxx_i2c_dma_release(i2c, req, req->status == req->num);
+		req->complete(req, req->status);
+	}
+}
+
+static enum hrtimer_restart xxx_i2c_timeout(struct hrtimer *t)
+{
+	struct xxx_i2c *i2c = container_of(t, struct xxx_i2c, timer);
+
+	/* 超时时DMA可能还在进行，要等它停下来才能解除映射，只能在进程上下文做 */
+	schedule_work(&i2c->timeout_work);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * 记录一次超时或卡死，SCL或SDA仍被拉低时用bus_recovery_info恢复总线。
+ * stall_start为最后一次有进展的时间。调用者保证控制器上没有正在进行的
+ * 传输（当前请求未清空或SMBus序列器仍被占用），可以睡眠。
+ */
+static void xxx_i2c_stall_recover(struct xxx_i2c *i2c, ktime_t stall_start)
+{
+	struct xxx_i2c_fault_stats *fs = &i2c->faults;
+	ktime_t start = ktime_get();
+	u64 stall = ktime_to_ns(ktime_sub(start, stall_start));
+	u64 recovery = 0;
+	int ret = 0;
+	bool stuck;
+
+	/* 两根线都是高电平说明只是传输太慢，总线本身是空闲的。从设备可能
+	 * 正好在延展时钟，一次采到低电平不算，持续一段时间都不空闲才恢复 */
+	for (;;) {
+		stuck = !i2c_adapter_xxx_get_scl() || !i2c_adapter_xxx_get_sda();
+		if (!stuck ||
+		    ktime_us_delta(ktime_get(), start) >= XXX_I2C_STUCK_CONFIRM_US)
+			break;
+		usleep_range(50, 100);
+	}
+	if (stuck) {
+		ret = i2c_recover_bus(&i2c->adap);
+		recovery = ktime_to_ns(ktime_sub(ktime_get(), start));
+		xxx_i2c_stat_inc(i2c, XXX_STAT_RECOVERIES);
+		if (ret)
+			dev_warn(&i2c->adap.dev, "bus recovery failed: %d\n", ret);
+	}
+
+	spin_lock_irq(&i2c->lock);
+	fs->stalls++;
+	fs->stall_ns += stall;
+	fs->max_stall_ns = max(fs->max_stall_ns, stall);
+	if (stuck) {
+		fs->recoveries++;
+		if (ret)
+			fs->recovery_failed++;
+		fs->recovery_ns += recovery;
+		fs->max_recovery_ns = max(fs->max_recovery_ns, recovery);
+	}
+	spin_unlock_irq(&i2c->lock);
+}
+
+static void xxx_i2c_timeout_work(struct work_struct *work)
+{
+	struct xxx_i2c *i2c = container_of(work, struct xxx_i2c, timeout_work);
+	struct xxx_i2c_req *req;
+	ktime_t stall_start, quiet;
+	int status;
+
+	spin_lock_irq(&i2c->lock);
+	req = i2c->cur;
+	/* 定时器到期后请求可能已经正常完成了，下一个请求的期限还没到 */
+	if (!req || (!i2c->stall_status && ktime_before(ktime_get(), i2c->deadline))) {
+		spin_unlock_irq(&i2c->lock);
+		return;
+	}
+	/* 过了期限但stuck_us内还有进展，从设备在延展时钟，期限顺延 */
+	quiet = ktime_add_us(i2c->progress, xxx_i2c_stuck_us());
+	if (!i2c->stall_status && adaptive_timeout &&
+	    ktime_before(ktime_get(), quiet)) {
+		i2c->deadline = quiet;
+		hrtimer_start(&i2c->timer, quiet, HRTIMER_MODE_ABS);
+		spin_unlock_irq(&i2c->lock);
+		return;
+	}
+
+	status = i2c->stall_status ? i2c->stall_status : -ETIMEDOUT;
+	i2c->stall_status = 0;
+	stall_start = i2c->progress;
+	if (status == -ETIMEDOUT) {
+		dev_dbg(&i2c->adap.dev, "timeout\n");
+		xxx_i2c_stat_inc(i2c, XXX_STAT_TIMEOUTS);
+	}
+	i2c_adapter_xxx_stop();
+	i2c_adapter_xxx_disable_irq();
+	i2c_adapter_xxx_disable_dma();
+	/* cur暂不清空，DMA通道停下来之前不能派发下一个请求 */
+	i2c->state = STATE_STOP;
+	i2c->msg_num = 0;
+	i2c->msg = NULL;
+	req->status = status;
+	xxx_i2c_account(i2c, req);
+	spin_unlock_irq(&i2c->lock);
+
+	if (req->dma) {
+		dmaengine_terminate_sync(i2c->dma_tx);
+		dmaengine_terminate_sync(i2c->dma_rx);
+	}
+
+	/* cur还没清空，恢复期间不会派发别的请求。NAK、仲裁失败等DMA方式下的
+	 * 出错也经过这里，总线并没有卡住 */
+	if (status == -ETIMEDOUT || status == -EBUSY)
+		xxx_i2c_stall_recover(i2c, stall_start);
+
+	spin_lock_irq(&i2c->lock);
+	i2c->cur = NULL;
+	i2c->dma = NULL;
+	xxx_i2c_dispatch(i2c);
+	spin_unlock_irq(&i2c->lock);
+
+	xxx_i2c_dma_release(i2c, req, false);
+	req->complete(req, status);
+	xxx_i2c_run_completions(i2c);
+}
+
+/* 原来的忙等方式，没有中断或use_polling时使用 */
+static int xxx_i2c_xfer_polled(struct xxx_i2c *i2c, struct i2c_msg *msgs,
+		int num)
+{
+	int i;
+
+	xxx_i2c_set_speed(i2c, xxx_i2c_pick_speed(i2c, msgs, num));
+	for (i = 0; i < num; i++) {
+		i2c->mode_hits[XXX_XFER_PIO]++;
+		i2c_adapter_xxx_start(); /* 产生开始位 */
+		/*是读消息 */
+		if (msgs[i].flags & I2C_M_RD) {
+			i2c_adapter_xxx_setaddr((msgs[i].addr << 1) | 1); /* 发送从设备读地址 */
+			i2c_adapter_xxx_wait_ack(); /* 获得从设备的ack */
+			i2c_adapter_xxx_readbytes(msgs[i].buf, msgs[i].len); /* 读取msgs[i].len
+																	长的数据到msgs[i].buf */
+		} else { /* 是写消息 */
+			i2c_adapter_xxx_setaddr(msgs[i].addr << 1); /* 发送从设备写地址 */
+			i2c_adapter_xxx_wait_ack(); /* 获得从设备的ack */
+			i2c_adapter_xxx_writebytes(msgs[i].buf, msgs[i].len); /* 写msgs[i].buf中
+																	msgs[i].len长的数据 */
+		}
+	}
+	i2c_adapter_xxx_stop(); /* 产生停止位 */
+
+	return num;
+}
+
+/**
+ * xxx_i2c_submit - 异步提交一个传输请求
+ * @adap: xxx_i2c适配器
+ * @req: 请求，msgs/num/prio/complete/context由调用者填好
+ *
+ * 只能在进程上下文中调用（DMA缓冲区在这里准备）。请求不经过适配器的
+ * bus_lock，与i2c_transfer()提交的传输在同一个队列里按优先级排队，
+ * 每个请求内部的消息仍然在一次START...STOP中原子地完成。
+ * 返回0表示已入队，结果通过req->complete()通知；总线被其他主机占用时
+ * complete()可能在返回之前就以-EAGAIN被调用。
+ */
+int xxx_i2c_submit(struct i2c_adapter *adap, struct xxx_i2c_req *req)
+{
+	struct xxx_i2c *i2c;
+	struct xxx_i2c_qstats *qs;
+	unsigned long flags;
+
+	if (adap->algo != &xxx_i2c_algorithm)
+		return -EINVAL;
+	if (req->num <= 0 || req->prio >= XXX_PRIO_NR || !req->complete)
+		return -EINVAL;
+
+	i2c = i2c_get_adapdata(adap);
+	if (use_polling || i2c->irq < 0)
+		return -EOPNOTSUPP;
+
+	might_sleep();
+	req->dma = xxx_i2c_dma_prepare(i2c, req->msgs, req->num);
+	req->speed = xxx_i2c_pick_speed(i2c, req->msgs, req->num);
+	req->submitted = ktime_get();
+
+	spin_lock_irqsave(&i2c->lock, flags);
+	list_add_tail(&req->node, &i2c->queue[req->prio]);
+	qs = &i2c->qstats[req->prio];
+	qs->depth++;
+	qs->max_depth = max(qs->max_depth, qs->depth);
+	xxx_i2c_dispatch(i2c);
+	spin_unlock_irqrestore(&i2c->lock, flags);
+
+	xxx_i2c_run_completions(i2c);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xxx_i2c_submit);
+
+static void xxx_i2c_sync_complete(struct xxx_i2c_req *req, int status)
+{
+	complete(req->context);
+}
+
+/* i2c_transfer()的同步传输也走提交队列，短的寄存器访问按HIGH提交 */
+static enum xxx_i2c_prio xxx_i2c_classify(struct i2c_msg *msgs, int num)
+{
+	unsigned int len = 0;
+	int i;
+
+	for (i = 0; i < num; i++)
+		len += msgs[i].len;
+
+	return len <= XXX_I2C_HIGH_LEN ? XXX_PRIO_HIGH : XXX_PRIO_BULK;
+}
+
+/* 执行一次传输，成功返回消息数，失败返回负的错误码 */
+static int xxx_i2c_doxfer(struct xxx_i2c *i2c, struct i2c_msg *msgs, int num)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct xxx_i2c_req req = {
+		.msgs = msgs,
+		.num = num,
+		.prio = xxx_i2c_classify(msgs, num),
+		.complete = xxx_i2c_sync_complete,
+		.context = &done,
+	};
+	int ret;
+
+	ret = xxx_i2c_submit(&i2c->adap, &req);
+	if (ret)
+		return ret;
+
+	/* 超时由请求自己的定时器处理，这里一定会等到回调 */
+	wait_for_completion(&done);
+
+	return req.status;
+}
+
+/* 返回-EAGAIN时，i2c核心会在adap.timeout内最多重试adap.retries次 */
+static int xxx_i2c_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
+		int num)
+{
+	struct xxx_i2c *i2c = i2c_get_adapdata(adap);
+	ktime_t start;
+	u64 ns;
+	int ret;
+
+	if (use_polling || i2c->irq < 0) {
+		start = xxx_i2c_time_start();
+		ret = xxx_i2c_xfer_polled(i2c, msgs, num);
+		ns = xxx_i2c_time_ns(start);
+		xxx_i2c_stat_msgs(i2c, msgs, num, ret, ns);
+		xxx_i2c_trace(i2c, msgs, num, ret, ns);
+		return ret;
+	}
+
+	ret = xxx_i2c_doxfer(i2c, msgs, num);
+	if (ret == -EAGAIN)
+		xxx_i2c_stat_inc(i2c, XXX_STAT_RETRIES);
+
+	return ret;
+}
+
+/* 用控制器的硬件SMBus命令序列器直接执行SMBus事务：地址、命令、数据、
+ * 重复START和PEC都由硬件完成，整条命令只产生一次中断，省去了i2c核心
+ * 把SMBus事务翻译成i2c_msg数组再逐字节推进状态机的开销。
+ * 返回-EOPNOTSUPP时，i2c核心会退回到用master_xfer模拟。 */
+static int xxx_i2c_smbus_xfer(struct i2c_adapter *adap, u16 addr,
+			      unsigned short flags, char read_write,
+			      u8 command, int size, union i2c_smbus_data *data)
+{
+	struct xxx_i2c *i2c = i2c_get_adapdata(adap);
+	bool rd = read_write == I2C_SMBUS_READ;
+	bool pec = flags & I2C_CLIENT_PEC;
+	u8 buf[I2C_SMBUS_BLOCK_MAX];
+	unsigned long timeout;
+	unsigned int len = 0;
+	unsigned int rdlen = 0;
+	unsigned int speed;
+	u64 bits;
+	ktime_t start;
+	u64 ns;
+	int ret;
+
+	/* 忙等方式和10位地址不使用序列器 */
+	if (use_polling || i2c->irq < 0 || (flags & I2C_CLIENT_TEN))
+		return -EOPNOTSUPP;
+
+	switch (size) {
+	case I2C_SMBUS_QUICK:
+		pec = false;
+		break;
+	case I2C_SMBUS_BYTE:
+		/* 写时要发送的字节就是command */
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		if (!rd) {
+			buf[0] = data->byte;
+			len = 1;
+		}
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		if (!rd) {
+			buf[0] = data->word & 0xff;
+			buf[1] = data->word >> 8;
+			len = 2;
+		}
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		if (!rd) {
+			len = data->block[0];
+			if (len == 0 || len > I2C_SMBUS_BLOCK_MAX)
+				return -EINVAL;
+			memcpy(buf, &data->block[1], len);
+		}
+		break;
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		len = data->block[0];
+		if (len == 0 || len > I2C_SMBUS_BLOCK_MAX)
+			return -EINVAL;
+		if (!rd)
+			memcpy(buf, &data->block[1], len);
+		pec = false;
+		break;
+	default:
+		/* 过程调用等序列器不支持的协议 */
+		return -EOPNOTSUPP;
+	}
+
+	spin_lock_irq(&i2c->lock);
+	/* 控制器正被提交队列中的请求占用，交给i2c核心模拟后排队 */
+	if (i2c->cur || !list_empty(&i2c->queue[XXX_PRIO_HIGH]) ||
+	    !list_empty(&i2c->queue[XXX_PRIO_BULK])) {
+		spin_unlock_irq(&i2c->lock);
+		return -EOPNOTSUPP;
+	}
+	i2c->smbus_active = true;
+	i2c->state = STATE_SMBUS;
+	i2c->smbus_status = -EIO;
+	start = ktime_get();
+	/* 地址、命令、数据和PEC，读时再加重复START、地址和最长的块 */
+	bits = (3 + len + (rd ? I2C_SMBUS_BLOCK_MAX + 2 : 0)) * 9 + 3;
+	speed = xxx_i2c_speed_index(i2c, READ_ONCE(i2c->addr_freq[addr & 0x7f]));
+	xxx_i2c_set_speed(i2c, speed);
+	/* 设置地址、读写方向、命令字节、协议、是否附加PEC以及数据长度 */
+	i2c_adapter_xxx_smbus_setup(addr, rd, command, size, pec, len);
+	if (!rd && len)
+		i2c_adapter_xxx_write_fifo(buf, len);
+	i2c_adapter_xxx_enable_irq();
+	i2c_adapter_xxx_smbus_start();
+	spin_unlock_irq(&i2c->lock);
+
+	/* 序列器在命令结束前没有中断，看不到进展，按最长的合法时钟延展放宽；
+	 * 真正卡死时控制器会先报XXX_I2C_STAT_BUS_STUCK */
+	timeout = nsecs_to_jiffies(ktime_to_ns(xxx_i2c_bits_timeout(i2c, bits, speed))) +
+		  usecs_to_jiffies(xxx_i2c_stuck_us()) + 1;
+	timeout = wait_event_timeout(i2c->wait, i2c->state != STATE_SMBUS, timeout);
+
+	spin_lock_irq(&i2c->lock);
+	if (timeout == 0 && i2c->state == STATE_SMBUS) {
+		dev_dbg(&i2c->adap.dev, "smbus timeout\n");
+		xxx_i2c_stat_inc(i2c, XXX_STAT_TIMEOUTS);
+		i2c_adapter_xxx_smbus_abort();
+		i2c_adapter_xxx_disable_irq();
+		ret = -ETIMEDOUT;
+	} else {
+		ret = i2c->smbus_status;
+	}
+	spin_unlock_irq(&i2c->lock);
+
+	/* smbus_active期间不会派发队列中的请求，可以直接恢复总线 */
+	if (ret == -ETIMEDOUT || ret == -EBUSY)
+		xxx_i2c_stall_recover(i2c, start);
+
+	if (ret || !rd)
+		goto out;
+
+	/* smbus_active期间不会派发队列中的请求，可以在锁外取数据 */
+	switch (size) {
+	case I2C_SMBUS_BYTE:
+	case I2C_SMBUS_BYTE_DATA:
+		i2c_adapter_xxx_read_fifo(buf, 1);
+		data->byte = buf[0];
+		rdlen = 1;
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		i2c_adapter_xxx_read_fifo(buf, 2);
+		data->word = buf[0] | (buf[1] << 8);
+		rdlen = 2;
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		len = i2c_adapter_xxx_smbus_count(); /* 从设备返回的长度字节 */
+		if (len == 0 || len > I2C_SMBUS_BLOCK_MAX) {
+			ret = -EPROTO;
+			break;
+		}
+		i2c_adapter_xxx_read_fifo(&data->block[1], len);
+		data->block[0] = len;
+		rdlen = len + 1;
+		break;
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		i2c_adapter_xxx_read_fifo(&data->block[1], len);
+		rdlen = len;
+		break;
+	}
+
+out:
+	/* 整条命令算一次传输，写字节数包括命令字节 */
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	xxx_i2c_stat_xfer(i2c, ret ? 0 : 1, rdlen, ret ? 0 : 1 + (rd ? 0 : len), ns);
+	xxx_i2c_trace_smbus(i2c, addr, rd, command, size, buf, rd ? 0 : len,
+			    data, ret, ns);
+	if (ret == -EAGAIN)
+		xxx_i2c_stat_inc(i2c, XXX_STAT_RETRIES);
+
+	/* 命令期间提交的请求在这里开始 */
+	spin_lock_irq(&i2c->lock);
+	i2c->smbus_active = false;
+	i2c->state = STATE_IDLE;
+	xxx_i2c_dispatch(i2c);
+	spin_unlock_irq(&i2c->lock);
+
+	xxx_i2c_run_completions(i2c);
+
+	return ret;
+}
+
+static u32 xxx_i2c_func(struct i2c_adapter *adap)
+{
+	struct xxx_i2c *i2c = i2c_get_adapdata(adap);
+	/* 返回i2c的功能 */
+	u32 func = I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL |
+		I2C_FUNC_NOSTART | I2C_FUNC_PROTOCOL_MANGLING;
+
+	/* SMBus块读由序列器原生支持，中断方式下也能处理I2C_M_RECV_LEN；
+	 * 忙等方式两者都不支持，不能声明 */
+	if (!use_polling && i2c->irq >= 0)
+		func |= I2C_FUNC_SMBUS_READ_BLOCK_DATA;
+
+	if (IS_ENABLED(CONFIG_I2C_SLAVE))
+		func |= I2C_FUNC_SLAVE;
+
+	return func;
+}
+
+static const struct i2c_algorithm xxx_i2c_algorithm = {
+	.master_xfer		= xxx_i2c_xfer,
+	.smbus_xfer		= xxx_i2c_smbus_xfer,
+	.functionality		= xxx_i2c_func,
+#if IS_ENABLED(CONFIG_I2C_SLAVE)
+	.reg_slave		= xxx_i2c_reg_slave,
+	.unreg_slave		= xxx_i2c_unreg_slave,
+#endif
+};
+
+/* 各适配器的长度门限及每种搬运方式的命中次数，位于
+ * /sys/devices/platform/xxx_i2c.N/下 */
+static ssize_t fifo_threshold_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", i2c->fifo_threshold);
+}
+
+static ssize_t fifo_threshold_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val == 0)
+		return -EINVAL;
+
+	i2c_lock_bus(&i2c->adap, I2C_LOCK_ROOT_ADAPTER);
+	i2c->fifo_threshold = val;
+	i2c_unlock_bus(&i2c->adap, I2C_LOCK_ROOT_ADAPTER);
+
+	return count;
+}
+static DEVICE_ATTR_RW(fifo_threshold);
+
+static ssize_t dma_threshold_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", i2c->dma_threshold);
+}
+
+static ssize_t dma_threshold_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val == 0)
+		return -EINVAL;
+
+	/* 门限在xxx_i2c_dma_prepare()中使用，改动要和传输互斥 */
+	i2c_lock_bus(&i2c->adap, I2C_LOCK_ROOT_ADAPTER);
+	i2c->dma_threshold = val;
+	i2c_unlock_bus(&i2c->adap, I2C_LOCK_ROOT_ADAPTER);
+
+	return count;
+}
+static DEVICE_ATTR_RW(dma_threshold);
+
+static ssize_t mode_hits_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+
+	return sprintf(buf, "pio %lu\nfifo %lu\ndma %lu\n",
+		       i2c->mode_hits[XXX_XFER_PIO],
+		       i2c->mode_hits[XXX_XFER_FIFO],
+		       i2c->mode_hits[XXX_XFER_DMA]);
+}
+static DEVICE_ATTR_RO(mode_hits);
+
+/* 每个优先级类别的队列深度、等待时间（提交到开始）和服务时间（开始到完成） */
+static ssize_t queue_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	static const char * const names[XXX_PRIO_NR] = { "high", "bulk" };
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+	struct xxx_i2c_qstats qs[XXX_PRIO_NR];
+	ssize_t len;
+	int i;
+
+	spin_lock_irq(&i2c->lock);
+	memcpy(qs, i2c->qstats, sizeof(qs));
+	spin_unlock_irq(&i2c->lock);
+
+	len = sprintf(buf, "class depth max_depth count avg_wait_us max_wait_us "
+		      "avg_service_us max_service_us\n");
+	for (i = 0; i < XXX_PRIO_NR; i++)
+		len += sprintf(buf + len, "%s %u %u %lu %llu %llu %llu %llu\n",
+			       names[i], qs[i].depth, qs[i].max_depth, qs[i].count,
+			       qs[i].count ? div64_ul(qs[i].wait_ns, qs[i].count) / 1000 : 0,
+			       div_u64(qs[i].max_wait_ns, 1000),
+			       qs[i].count ? div64_ul(qs[i].service_ns, qs[i].count) / 1000 : 0,
+			       div_u64(qs[i].max_service_ns, 1000));
+
+	return len;
+}
+static DEVICE_ATTR_RO(queue_stats);
+
+/* 每档速度发出的传输数、切换次数，以及声明了非默认速度的从地址 */
+static ssize_t speed_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+	u32 def = i2c->speeds[i2c->default_speed].freq;
+	unsigned long xfers[XXX_I2C_NR_SPEEDS];
+	unsigned long retimes;
+	ssize_t len;
+	unsigned int i;
+	u32 f;
+
+	spin_lock_irq(&i2c->lock);
+	for (i = 0; i < i2c->nr_speeds; i++)
+		xfers[i] = i2c->speeds[i].xfers;
+	retimes = i2c->retimes;
+	spin_unlock_irq(&i2c->lock);
+
+	len = sprintf(buf, "freq xfers\n");
+	for (i = 0; i < i2c->nr_speeds; i++)
+		len += sprintf(buf + len, "%u %lu%s\n", i2c->speeds[i].freq, xfers[i],
+			       i == i2c->default_speed ? " default" : "");
+	len += sprintf(buf + len, "retimes %lu\n", retimes);
+	for (i = 0; i < ARRAY_SIZE(i2c->addr_freq); i++) {
+		f = READ_ONCE(i2c->addr_freq[i]);
+		if (f != def)
+			len += sprintf(buf + len, "client 0x%02x %u\n", i, f);
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RO(speed_stats);
+
+/* 超时及卡死的次数和持续时间、总线恢复的次数和耗时 */
+static ssize_t fault_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_i2c *i2c = dev_get_drvdata(dev);
+	struct xxx_i2c_fault_stats fs;
+
+	spin_lock_irq(&i2c->lock);
+	fs = i2c->faults;
+	spin_unlock_irq(&i2c->lock);
+
+	return sprintf(buf, "stalls %lu\nstall_us %llu\nmax_stall_us %llu\n"
+		       "recoveries %lu\nrecovery_failed %lu\nrecovery_us %llu\n"
+		       "max_recovery_us %llu\n",
+		       fs.stalls, div_u64(fs.stall_ns, 1000),
+		       div_u64(fs.max_stall_ns, 1000), fs.recoveries,
+		       fs.recovery_failed, div_u64(fs.recovery_ns, 1000),
+		       div_u64(fs.max_recovery_ns, 1000));
+}
+static DEVICE_ATTR_RO(fault_stats);
+
+static struct attribute *xxx_i2c_attrs[] = {
+	&dev_attr_fifo_threshold.attr,
+	&dev_attr_dma_threshold.attr,
+	&dev_attr_mode_hits.attr,
+	&dev_attr_queue_stats.attr,
+	&dev_attr_speed_stats.attr,
+	&dev_attr_fault_stats.attr,
+	NULL
+};
+
+static const struct attribute_group xxx_i2c_attr_group = {
+	.attrs = xxx_i2c_attrs,
+};
+
+#if IS_ENABLED(CONFIG_I2C_XXX_STATS)
+/* /sys/kernel/debug/xxx_i2c.N/stats：各计数器及按长度分组的延迟直方图 */
+static int xxx_i2c_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const names[XXX_STAT_NR] = {
+		"xfers", "msgs", "rd_bytes", "wr_bytes", "naks", "arb_lost",
+		"timeouts", "retries", "recoveries",
+	};
+	static const char * const sizes[XXX_SIZE_NR] = { "1-4", "5-63", "64+" };
+	struct xxx_i2c *i2c = s->private;
+	struct xxx_i2c_stats *sum, *p;
+	int cpu, i, j;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		p = per_cpu_ptr(i2c->stats, cpu);
+		for (i = 0; i < XXX_STAT_NR; i++)
+			sum->cnt[i] += p->cnt[i];
+		for (i = 0; i < XXX_SIZE_NR; i++)
+			for (j = 0; j < XXX_STAT_LAT_BUCKETS; j++)
+				sum->lat[i][j] += p->lat[i][j];
+	}
+
+	for (i = 0; i < XXX_STAT_NR; i++)
+		seq_printf(s, "%s %llu\n", names[i], sum->cnt[i]);
+
+	seq_puts(s, "latency_us");
+	for (j = 0; j < XXX_STAT_LAT_BUCKETS - 1; j++)
+		seq_printf(s, " <%lu", 1UL << j);
+	seq_printf(s, " >=%lu\n", 1UL << (j - 1));
+	for (i = 0; i < XXX_SIZE_NR; i++) {
+		seq_printf(s, "%s", sizes[i]);
+		for (j = 0; j < XXX_STAT_LAT_BUCKETS; j++)
+			seq_printf(s, " %llu", sum->lat[i][j]);
+		seq_putc(s, '\n');
+	}
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(xxx_i2c_stats);
+
+/* 写任意值清零。与其他CPU上正在进行的累加不互斥，清零瞬间可能丢几次计数 */
+static ssize_t xxx_i2c_stats_reset_write(struct file *file, const char __user *ubuf,
+					 size_t count, loff_t *ppos)
+{
+	struct xxx_i2c *i2c = file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(i2c->stats, cpu), 0, sizeof(struct xxx_i2c_stats));
+
+	return count;
+}
+
+static const struct file_operations xxx_i2c_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = xxx_i2c_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+#if IS_ENABLED(CONFIG_I2C_XXX_TRACE)
+/* 每条记录的长度要逐条消息累加，记录可能跨越缓冲区末尾 */
+static u32 xxx_i2c_trace_rec_len(struct xxx_i2c_trace_buf *tb, u32 pos)
 {
-	...
-	for (i = 0; i < num; i++) {
-		i2c_adapter_xxx_start(); /* 产生开始位 */
-		/*是读消息 */
-		if (msgs[i]->flags &I2C_M_RD) {
-			i2c_adapter_xxx_setaddr((msg->addr << 1) | 1); /* 发送从设备读地址 */
-			i2c_adapter_xxx_wait_ack(); /* 获得从设备的ack */
-			i2c_adapter_xxx_readbytes(msgs[i]->buf, msgs[i]->len); /* 读取msgs[i] ->len
-																	长的数据到msgs[i]->buf */
-		} else { /* 是写消息 */
-			i2c_adapter_xxx_setaddr(msg->addr << 1); /* 发送从设备写地址 */
-			i2c_adapter_xxx_wait_ack(); /* 获得从设备的ack */
-			i2c_adapter_xxx_writebytes(msgs[i]->buf, msgs[i]->len); /* 读取msgs[i]->len
-																	长的数据到msgs[i]->buf */
+	struct xxx_i2c_trace_xfer x;
+	struct xxx_i2c_trace_msg m;
+	u32 len = sizeof(x);
+	int i;
+
+	xxx_i2c_ring_copy_out(&x, tb->data, tb->mask, pos, sizeof(x));
+	for (i = 0; i < x.nmsgs; i++) {
+		xxx_i2c_ring_copy_out(&m, tb->data, tb->mask, pos + len, sizeof(m));
+		len += sizeof(m) + m.data_len;
+	}
+
+	return len;
+}
+
+/* 把一个CPU缓冲区中能放下的整条记录拷给用户，返回拷贝的字节数 */
+static ssize_t xxx_i2c_trace_drain(struct xxx_i2c_trace_buf *tb,
+				   char __user *ubuf, size_t count)
+{
+	u32 tail = tb->tail, head = smp_load_acquire(&tb->head);
+	u32 len, off, first;
+	ssize_t done = 0;
+
+	while (tail != head) {
+		len = xxx_i2c_trace_rec_len(tb, tail);
+		if (done + len > count)
+			break;
+		off = tail & tb->mask;
+		first = min(len, tb->mask + 1 - off);
+		if (copy_to_user(ubuf + done, tb->data + off, first) ||
+		    copy_to_user(ubuf + done + first, tb->data, len - first)) {
+			if (!done)
+				done = -EFAULT;
+			break;
 		}
+		done += len;
+		tail += len;
 	}
-	i2c_adapter_xxx_stop(); /* 产生停止位 */
+	smp_store_release(&tb->tail, tail);
+
+	return done;
 }
 
-static u32 xxx_i2c_func(struct i2c_adapter *adap)
+/* /sys/kernel/debug/xxx_i2c.N/trace：读出并清空所有CPU的缓冲区，
+ * 从头读时先输出文件头，可以直接cat > file */
+static ssize_t xxx_i2c_trace_read(struct file *file, char __user *ubuf,
+				  size_t count, loff_t *ppos)
 {
-	/* 返回i2c的功能 */
-	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL | I2C_FUNC_NOSTART |
-		I2C_FUNC_PROTOCOL_MANGLING;
+	struct xxx_i2c *i2c = file->private_data;
+	struct xxx_i2c_trace_file_hdr fh = {
+		.magic = XXX_I2C_TRACE_MAGIC,
+		.version = XXX_I2C_TRACE_VERSION,
+	};
+	ssize_t done = 0, n;
+	int cpu;
+
+	mutex_lock(&i2c->trace_lock);
+	if (!i2c->trace)
+		goto out;
+
+	if (*ppos == 0) {
+		fh.payload = i2c->trace_payload;
+		if (count < sizeof(fh)) {
+			done = -EINVAL;
+			goto out;
+		}
+		if (copy_to_user(ubuf, &fh, sizeof(fh))) {
+			done = -EFAULT;
+			goto out;
+		}
+		done = sizeof(fh);
+	}
+
+	for_each_possible_cpu(cpu) {
+		n = xxx_i2c_trace_drain(*per_cpu_ptr(i2c->trace, cpu),
+					ubuf + done, count - done);
+		if (n < 0) {
+			if (!done)
+				done = n;
+			break;
+		}
+		done += n;
+	}
+	if (done > 0)
+		*ppos += done;
+out:
+	mutex_unlock(&i2c->trace_lock);
+
+	return done;
 }
 
-static const struct i2c_algorithm xxx_i2c_algorithm = {
-	.master_xfer		= xxx_i2c_xfer,
-	.functionality		= xxx_i2c_func,
+static const struct file_operations xxx_i2c_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = xxx_i2c_trace_read,
+	.llseek = noop_llseek,
+};
+
+static int xxx_i2c_trace_alloc(struct xxx_i2c *i2c)
+{
+	struct xxx_i2c_trace_buf *tb;
+	u32 size = roundup_pow_of_two(max_t(u32, trace_buf_size, PAGE_SIZE));
+	int cpu;
+
+	i2c->trace = alloc_percpu(struct xxx_i2c_trace_buf *);
+	if (!i2c->trace)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		tb = kvzalloc_node(sizeof(*tb) + size, GFP_KERNEL, cpu_to_node(cpu));
+		if (!tb)
+			return -ENOMEM;	/* 已分配的由xxx_i2c_trace_free()释放 */
+		tb->mask = size - 1;
+		*per_cpu_ptr(i2c->trace, cpu) = tb;
+	}
+
+	return 0;
+}
+
+static void xxx_i2c_trace_free(struct xxx_i2c *i2c)
+{
+	int cpu;
+
+	if (!i2c->trace)
+		return;
+	for_each_possible_cpu(cpu)
+		kvfree(*per_cpu_ptr(i2c->trace, cpu));
+	free_percpu(i2c->trace);
+	i2c->trace = NULL;
+}
+
+/* trace_enable：写1/0开关捕获，读出开关状态和各CPU丢弃的传输数之和。
+ * 缓冲区在第一次开启时分配，关闭后保留到适配器移除，
+ * 写者不需要和释放同步 */
+static ssize_t xxx_i2c_trace_enable_read(struct file *file, char __user *ubuf,
+					 size_t count, loff_t *ppos)
+{
+	struct xxx_i2c *i2c = file->private_data;
+	u64 lost = 0;
+	char buf[48];
+	int cpu, len;
+
+	mutex_lock(&i2c->trace_lock);
+	if (i2c->trace)
+		for_each_possible_cpu(cpu)
+			lost += (*per_cpu_ptr(i2c->trace, cpu))->lost;
+	len = scnprintf(buf, sizeof(buf), "%d lost %llu\n", i2c->trace_on, lost);
+	mutex_unlock(&i2c->trace_lock);
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+static ssize_t xxx_i2c_trace_enable_write(struct file *file,
+					  const char __user *ubuf,
+					  size_t count, loff_t *ppos)
+{
+	struct xxx_i2c *i2c = file->private_data;
+	bool on;
+	int ret;
+
+	ret = kstrtobool_from_user(ubuf, count, &on);
+	if (ret)
+		return ret;
+
+	mutex_lock(&i2c->trace_lock);
+	if (on && !i2c->trace) {
+		ret = xxx_i2c_trace_alloc(i2c);
+		if (ret)
+			xxx_i2c_trace_free(i2c);
+	}
+	if (!ret)
+		smp_store_release(&i2c->trace_on, on);
+	mutex_unlock(&i2c->trace_lock);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations xxx_i2c_trace_enable_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = xxx_i2c_trace_enable_read,
+	.write = xxx_i2c_trace_enable_write,
+	.llseek = noop_llseek,
+};
+
+static void xxx_i2c_trace_init(struct xxx_i2c *i2c)
+{
+	mutex_init(&i2c->trace_lock);
+	i2c->trace_payload = 16;
+	debugfs_create_file("trace", 0400, i2c->debugfs, i2c, &xxx_i2c_trace_fops);
+	debugfs_create_file("trace_enable", 0600, i2c->debugfs, i2c,
+			    &xxx_i2c_trace_enable_fops);
+	debugfs_create_u32("trace_payload", 0600, i2c->debugfs, &i2c->trace_payload);
+}
+#else
+static inline void xxx_i2c_trace_init(struct xxx_i2c *i2c) {}
+static inline void xxx_i2c_trace_free(struct xxx_i2c *i2c) {}
+#endif
+
+static int xxx_i2c_stats_init(struct xxx_i2c *i2c, struct device *dev)
+{
+	i2c->stats = alloc_percpu(struct xxx_i2c_stats);
+	if (!i2c->stats)
+		return -ENOMEM;
+
+	/* debugfs失败不影响传输，不检查返回值 */
+	i2c->debugfs = debugfs_create_dir(dev_name(dev), NULL);
+	debugfs_create_file("stats", 0444, i2c->debugfs, i2c, &xxx_i2c_stats_fops);
+	debugfs_create_file("reset", 0200, i2c->debugfs, i2c,
+			    &xxx_i2c_stats_reset_fops);
+	xxx_i2c_trace_init(i2c);
+
+	return 0;
+}
+
+static void xxx_i2c_stats_exit(struct xxx_i2c *i2c)
+{
+	debugfs_remove_recursive(i2c->debugfs);
+	xxx_i2c_trace_free(i2c);
+	free_percpu(i2c->stats);
+}
+#else
+static inline int xxx_i2c_stats_init(struct xxx_i2c *i2c, struct device *dev)
+{
+	return 0;
+}
+static inline void xxx_i2c_stats_exit(struct xxx_i2c *i2c) {}
+#endif
+
+#if IS_ENABLED(CONFIG_I2C_SLAVE)
+/* "xxx-slave"后端的字符设备/dev/xxx-slave-<bus>-<addr>：
+ * read()每次返回整数个帧（struct xxx_slave_frame加len字节数据，
+ * 帧之间不填充），write()把要回给主机的数据放入发送环，poll()在
+ * 有帧可读/发送环有空间时就绪。
+ * mmap()映射struct xxx_slave_ring_hdr所在的一页和两个数据区，
+ * 用户程序可以不经过系统调用直接按头部注释中的规则收发，
+ * 但这样就不能再同时使用read()/write()，也不统计延迟。 */
+static void xxx_slave_free(struct kref *ref)
+{
+	struct xxx_slave *s = container_of(ref, struct xxx_slave, ref);
+
+	vfree(s->hdr);
+	kfree(s);
+}
+
+/* misc_open()持有misc_mtx调用open，与remove中的misc_deregister()互斥，
+ * 这里拿到的s一定还没有放掉probe的引用 */
+static int xxx_slave_open(struct inode *inode, struct file *filp)
+{
+	struct miscdevice *misc = filp->private_data;
+	struct xxx_slave *s = container_of(misc, struct xxx_slave, miscdev);
+
+	kref_get(&s->ref);
+	filp->private_data = s;
+
+	return 0;
+}
+
+static int xxx_slave_release(struct inode *inode, struct file *filp)
+{
+	struct xxx_slave *s = filp->private_data;
+
+	kref_put(&s->ref, xxx_slave_free);
+
+	return 0;
+}
+
+static bool xxx_slave_rx_ready(struct xxx_slave *s)
+{
+	return smp_load_acquire(&s->rx_head) != READ_ONCE(s->hdr->rx_tail) ||
+		READ_ONCE(s->removed);
+}
+
+static bool xxx_slave_tx_room(struct xxx_slave *s)
+{
+	return READ_ONCE(s->hdr->tx_head) - smp_load_acquire(&s->tx_tail) <=
+		s->tx_mask || READ_ONCE(s->removed);
+}
+
+static void xxx_slave_lat(struct xxx_slave *s, u64 ns)
+{
+	unsigned int b = min_t(unsigned int, ilog2(div_u64(ns, NSEC_PER_USEC) | 1),
+			       XXX_SLAVE_LAT_BUCKETS - 1);
+
+	s->lat[b]++;
+	if (ns > s->lat_max_ns)
+		s->lat_max_ns = ns;
+}
+
+static int xxx_slave_copy_to_user(char __user *ubuf, struct xxx_slave *s,
+				  u32 pos, u32 n)
+{
+	u32 off = pos & s->rx_mask, first = min(n, s->rx_mask + 1 - off);
+
+	if (copy_to_user(ubuf, s->rx + off, first) ||
+	    copy_to_user(ubuf + first, s->rx, n - first))
+		return -EFAULT;
+
+	return 0;
+}
+
+static ssize_t xxx_slave_read(struct file *filp, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct xxx_slave *s = filp->private_data;
+	struct xxx_slave_frame f;
+	u32 head, tail;
+	size_t done = 0;
+	u64 now;
+	int ret = 0;
+
+	for (;;) {
+		if (!xxx_slave_rx_ready(s)) {
+			if (filp->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(s->wait, xxx_slave_rx_ready(s));
+			if (ret)
+				return ret;
+		}
+		/* 可能有多个读者，环只允许一个消费者 */
+		if (mutex_lock_interruptible(&s->read_lock))
+			return -ERESTARTSYS;
+		if (READ_ONCE(s->removed)) {
+			mutex_unlock(&s->read_lock);
+			return -ENODEV;
+		}
+		if (xxx_slave_rx_ready(s))
+			break;
+		mutex_unlock(&s->read_lock);
+	}
+
+	tail = s->rx_tail;
+	head = smp_load_acquire(&s->rx_head);
+	if (WARN_ON_ONCE(head - tail > s->rx_mask + 1))
+		tail = head;
+	now = ktime_get_ns();
+	while (tail != head) {
+		xxx_i2c_ring_copy_out(&f, s->rx, s->rx_mask, tail, sizeof(f));
+		/* 帧头在映射区中，可能被用户改写，len不能超出已发布的数据 */
+		f.len = min_t(u32, f.len, head - tail - sizeof(f));
+		if (done + sizeof(f) + f.len > count)
+			break;
+		if (copy_to_user(buf + done, &f, sizeof(f)) ||
+		    xxx_slave_copy_to_user(buf + done + sizeof(f), s, tail + sizeof(f), f.len)) {
+			ret = -EFAULT;
+			break;
+		}
+		done += sizeof(f) + f.len;
+		tail += ALIGN(sizeof(f) + f.len, XXX_SLAVE_ALIGN);
+		xxx_slave_lat(s, now - f.timestamp);
+	}
+	s->rx_tail = tail;
+	smp_store_release(&s->hdr->rx_tail, tail);
+	mutex_unlock(&s->read_lock);
+
+	if (done)
+		return done;
+
+	/* 缓冲区连一帧都放不下 */
+	return ret ? ret : -EINVAL;
+}
+
+static ssize_t xxx_slave_write(struct file *filp, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct xxx_slave *s = filp->private_data;
+	u32 head, off, first, n;
+	int ret;
+
+	for (;;) {
+		if (!xxx_slave_tx_room(s)) {
+			if (filp->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(s->wait, xxx_slave_tx_room(s));
+			if (ret)
+				return ret;
+		}
+		if (mutex_lock_interruptible(&s->write_lock))
+			return -ERESTARTSYS;
+		if (READ_ONCE(s->removed)) {
+			mutex_unlock(&s->write_lock);
+			return -ENODEV;
+		}
+		if (xxx_slave_tx_room(s))
+			break;
+		mutex_unlock(&s->write_lock);
+	}
+
+	head = s->tx_head;
+	n = min_t(size_t, count,
+		  s->tx_mask + 1 - (head - smp_load_acquire(&s->tx_tail)));
+	off = head & s->tx_mask;
+	first = min(n, s->tx_mask + 1 - off);
+	if (copy_from_user(s->tx + off, buf, first) ||
+	    copy_from_user(s->tx, buf + first, n - first)) {
+		mutex_unlock(&s->write_lock);
+		return -EFAULT;
+	}
+	s->tx_head = head + n;
+	smp_store_release(&s->hdr->tx_head, head + n);
+	mutex_unlock(&s->write_lock);
+
+	return n;
+}
+
+static __poll_t xxx_slave_poll(struct file *filp, poll_table *wait)
+{
+	struct xxx_slave *s = filp->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(filp, &s->wait, wait);
+
+	if (READ_ONCE(s->removed))
+		return EPOLLERR | EPOLLHUP;
+	if (xxx_slave_rx_ready(s))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (xxx_slave_tx_room(s))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+static int xxx_slave_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct xxx_slave *s = filp->private_data;
+
+	if (READ_ONCE(s->removed))
+		return -ENODEV;
+
+	return remap_vmalloc_range(vma, s->hdr, vma->vm_pgoff);
+}
+
+static const struct file_operations xxx_slave_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xxx_slave_open,
+	.release	= xxx_slave_release,
+	.read		= xxx_slave_read,
+	.write		= xxx_slave_write,
+	.poll		= xxx_slave_poll,
+	.mmap		= xxx_slave_mmap,
+	.llseek		= no_llseek,
+};
+
+/* /sys/bus/i2c/devices/<bus>-<addr>/slave_stats */
+static ssize_t slave_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct xxx_slave *s = i2c_get_clientdata(to_i2c_client(dev));
+	struct xxx_slave_ring_hdr *hdr = s->hdr;
+	ssize_t len;
+	int b;
+
+	len = sprintf(buf, "rx_frames %llu\nrx_bytes %llu\nrx_dropped %llu\n"
+		      "tx_bytes %llu\ntx_underrun %llu\nfifo_chunks %llu\n"
+		      "lat_max_us %llu\nlat_us",
+		      hdr->rx_frames, hdr->rx_bytes, hdr->rx_dropped,
+		      hdr->tx_bytes, hdr->tx_underrun, hdr->fifo_chunks,
+		      div_u64(s->lat_max_ns, NSEC_PER_USEC));
+	/* 第b组为[2^b, 2^(b+1))微秒 */
+	for (b = 0; b < XXX_SLAVE_LAT_BUCKETS; b++)
+		len += sprintf(buf + len, " %llu", s->lat[b]);
+	len += sprintf(buf + len, "\n");
+
+	return len;
+}
+static DEVICE_ATTR_RO(slave_stats);
+
+static struct attribute *xxx_slave_attrs[] = {
+	&dev_attr_slave_stats.attr,
+	NULL
 };
 
+static const struct attribute_group xxx_slave_attr_group = {
+	.attrs = xxx_slave_attrs,
+};
+
+/* 通过设备树（reg加I2C_OWN_SLAVE_ADDRESS）或者
+ * echo xxx-slave 0x1064 > /sys/bus/i2c/devices/i2c-N/new_device
+ * 在本机的slave地址上实例化 */
+static int xxx_slave_probe(struct i2c_client *client,
+			   const struct i2c_device_id *id)
+{
+	struct xxx_slave *s;
+	u32 size;
+	int ret;
+
+	size = roundup_pow_of_two(max_t(u32, slave_ring_size, PAGE_SIZE));
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+	kref_init(&s->ref);
+
+	s->hdr = vmalloc_user(PAGE_SIZE + 2 * size);
+	if (!s->hdr) {
+		kfree(s);
+		return -ENOMEM;
+	}
+	s->hdr->rx_offset = PAGE_SIZE;
+	s->hdr->rx_size = size;
+	s->hdr->tx_offset = PAGE_SIZE + size;
+	s->hdr->tx_size = size;
+	s->rx = (u8 *)s->hdr + PAGE_SIZE;
+	s->tx = s->rx + size;
+	s->rx_mask = size - 1;
+	s->tx_mask = size - 1;
+	s->client = client;
+	init_waitqueue_head(&s->wait);
+	mutex_init(&s->read_lock);
+	mutex_init(&s->write_lock);
+	i2c_set_clientdata(client, s);
+
+	snprintf(s->miscname, sizeof(s->miscname), "xxx-slave-%d-%04x",
+		 i2c_adapter_id(client->adapter), client->addr);
+	s->miscdev.minor = MISC_DYNAMIC_MINOR;
+	s->miscdev.name = s->miscname;
+	s->miscdev.fops = &xxx_slave_fops;
+	s->miscdev.parent = &client->dev;
+	ret = misc_register(&s->miscdev);
+	if (ret)
+		goto err_free;
+
+	ret = devm_device_add_group(&client->dev, &xxx_slave_attr_group);
+	if (ret)
+		goto err_misc;
+
+	ret = i2c_slave_register(client, xxx_slave_cb);
+	if (ret)
+		goto err_misc;
+
+	return 0;
+
+err_misc:
+	misc_deregister(&s->miscdev);
+err_free:
+	kref_put(&s->ref, xxx_slave_free);
+	return ret;
+}
+
+static int xxx_slave_remove(struct i2c_client *client)
+{
+	struct xxx_slave *s = i2c_get_clientdata(client);
+
+	i2c_slave_unregister(client);
+	misc_deregister(&s->miscdev);
+
+	/* 中断已不再访问环，唤醒还在等待的读者/写者让它们返回-ENODEV，
+	 * 环和s等最后一个fd关闭时再释放 */
+	WRITE_ONCE(s->removed, true);
+	wake_up_interruptible(&s->wait);
+	kref_put(&s->ref, xxx_slave_free);
+
+	return 0;
+}
+
+static const struct i2c_device_id xxx_slave_ids[] = {
+	{ "xxx-slave", 0 },
+	{ }
+};
+MODULE_DEVICE_TABLE(i2c, xxx_slave_ids);
+
+static struct i2c_driver xxx_slave_driver = {
+	.driver = {
+		.name = "xxx-slave",
+	},
+	.probe = xxx_slave_probe,
+	.remove = xxx_slave_remove,
+	.id_table = xxx_slave_ids,
+};
+#endif
+
+/* DMA是可选的，申请不到通道时只用PIO/FIFO */
+static void xxx_i2c_dma_init(struct xxx_i2c *i2c, struct device *dev)
+{
+	struct dma_slave_config cfg = {
+		.src_addr_width = DMA_SLAVE_BUSWIDTH_1_BYTE,
+		.dst_addr_width = DMA_SLAVE_BUSWIDTH_1_BYTE,
+		.src_maxburst = XXX_I2C_FIFO_DEPTH / 2,
+		.dst_maxburst = XXX_I2C_FIFO_DEPTH / 2,
+		...	/* src_addr/dst_addr为控制器数据寄存器的物理地址 */
+	};
+
+	i2c->dma_tx = dma_request_chan(dev, "tx");
+	if (IS_ERR(i2c->dma_tx)) {
+		i2c->dma_tx = NULL;
+		return;
+	}
+	i2c->dma_rx = dma_request_chan(dev, "rx");
+	if (IS_ERR(i2c->dma_rx)) {
+		dma_release_channel(i2c->dma_tx);
+		i2c->dma_tx = NULL;
+		i2c->dma_rx = NULL;
+		return;
+	}
+
+	cfg.direction = DMA_MEM_TO_DEV;
+	dmaengine_slave_config(i2c->dma_tx, &cfg);
+	cfg.direction = DMA_DEV_TO_MEM;
+	dmaengine_slave_config(i2c->dma_rx, &cfg);
+}
+
+static void xxx_i2c_dma_free(struct xxx_i2c *i2c)
+{
+	if (i2c->dma_tx)
+		dma_release_channel(i2c->dma_tx);
+	if (i2c->dma_rx)
+		dma_release_channel(i2c->dma_rx);
+}
+
+/* bus_recovery_info的回调：恢复期间SCL/SDA切换成由软件直接驱动，
+ * i2c_generic_scl_recovery()据此发最多9个时钟脉冲和STOP */
+static int xxx_i2c_get_scl(struct i2c_adapter *adap)
+{
+	return i2c_adapter_xxx_get_scl();
+}
+
+static void xxx_i2c_set_scl(struct i2c_adapter *adap, int val)
+{
+	i2c_adapter_xxx_set_scl(val);
+}
+
+static int xxx_i2c_get_sda(struct i2c_adapter *adap)
+{
+	return i2c_adapter_xxx_get_sda();
+}
+
+static void xxx_i2c_set_sda(struct i2c_adapter *adap, int val)
+{
+	i2c_adapter_xxx_set_sda(val);
+}
+
+static void xxx_i2c_prepare_recovery(struct i2c_adapter *adap)
+{
+	i2c_adapter_xxx_bitbang(true);
+}
+
+static void xxx_i2c_unprepare_recovery(struct i2c_adapter *adap)
+{
+	struct xxx_i2c *i2c = i2c_get_adapdata(adap);
+
+	i2c_adapter_xxx_bitbang(false);
+	/* 控制器的状态机可能还停在卡死时的状态，复位后重新设置速度 */
+	i2c_adapter_xxx_reset();
+	i2c_adapter_xxx_set_divider(i2c->speeds[i2c->cur_speed].div);
+}
+
+/* 本适配器（及其下挂的多路复用子总线）上的客户端添加时记下它的速度，
+ * 删除时恢复为默认速度 */
+static int xxx_i2c_bus_notify(struct notifier_block *nb, unsigned long action,
+			      void *data)
+{
+	struct xxx_i2c *i2c = container_of(nb, struct xxx_i2c, bus_nb);
+	struct i2c_client *client = i2c_verify_client(data);
+	u32 freq;
+
+	if (!client || i2c_root_adapter(&client->adapter->dev) != &i2c->adap ||
+	    (client->flags & (I2C_CLIENT_TEN | I2C_CLIENT_SLAVE)))
+		return NOTIFY_DONE;
+
+	switch (action) {
+	case BUS_NOTIFY_ADD_DEVICE:
+		if (device_property_read_u32(&client->dev, "clock-frequency", &freq) ||
+		    !freq)
+			freq = i2c->speeds[i2c->default_speed].freq;
+		else if (freq < i2c->speeds[0].freq)
+			dev_warn(&client->dev, "%u Hz is below the slowest bus speed %u Hz\n",
+				 freq, i2c->speeds[0].freq);
+		break;
+	case BUS_NOTIFY_DEL_DEVICE:
+		freq = i2c->speeds[i2c->default_speed].freq;
+		break;
+	default:
+		return NOTIFY_DONE;
+	}
+
+	WRITE_ONCE(i2c->addr_freq[client->addr & 0x7f], min_t(u32, freq, XXX_I2C_MAX_FREQ));
+
+	return NOTIFY_OK;
+}
+
+/* 档位为标准的100k、400k、1M加上适配器的clock-frequency（不超过控制器
+ * 的上限），去重后按频率升序排列，分频值按上升/下降时间一次算好 */
+static void xxx_i2c_speed_init(struct xxx_i2c *i2c, struct device *dev)
+{
+	static const u32 std[] = {
+		I2C_MAX_STANDARD_MODE_FREQ,
+		I2C_MAX_FAST_MODE_FREQ,
+		I2C_MAX_FAST_MODE_PLUS_FREQ,
+	};
+	u32 def, freq;
+	unsigned int i, j, n = 0;
+
+	i2c_parse_fw_timings(dev, &i2c->timings, true);
+	def = min_t(u32, i2c->timings.bus_freq_hz, XXX_I2C_MAX_FREQ);
+
+	for (i = 0; i <= ARRAY_SIZE(std); i++) {
+		freq = i < ARRAY_SIZE(std) ? std[i] : def;
+		for (j = 0; j < n && i2c->speeds[j].freq != freq; j++)
+			;
+		if (j < n)
+			continue;
+		for (j = n; j > 0 && i2c->speeds[j - 1].freq > freq; j--)
+			i2c->speeds[j] = i2c->speeds[j - 1];
+		i2c->speeds[j].freq = freq;
+		i2c->speeds[j].xfers = 0;
+		n++;
+	}
+	i2c->nr_speeds = n;
+
+	for (i = 0; i < n; i++)
+		i2c->speeds[i].div = i2c_adapter_xxx_calc_divider(i2c->speeds[i].freq,
+								  &i2c->timings);
+	i2c->default_speed = xxx_i2c_speed_index(i2c, def);
+	for (i = 0; i < ARRAY_SIZE(i2c->addr_freq); i++)
+		i2c->addr_freq[i] = def;
+
+	/* xxx_adapter_hw_init()之后控制器就处于默认速度 */
+	i2c_adapter_xxx_set_divider(i2c->speeds[i2c->default_speed].div);
+	i2c->cur_speed = i2c->default_speed;
+}
+
 static int xxx_i2c_probe(struct platform_device *pdev)
 {
 	//struct i2c_adapter *adap;
@@ -159,10 +3001,68 @@ static int xxx_i2c_probe(struct platform_device *pdev)
 	...
 	xxx_adapter_hw_init(); /* 初始化i2c适配器硬件 */
 	/* 需要为i2c申请空间，此处略去 */
+	spin_lock_init(&i2c->lock);
+	init_waitqueue_head(&i2c->wait);
+	INIT_LIST_HEAD(&i2c->queue[XXX_PRIO_HIGH]);
+	INIT_LIST_HEAD(&i2c->queue[XXX_PRIO_BULK]);
+	INIT_LIST_HEAD(&i2c->done);
+	hrtimer_init(&i2c->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	i2c->timer.function = xxx_i2c_timeout;
+	INIT_WORK(&i2c->timeout_work, xxx_i2c_timeout_work);
+
+	/* 没有中断时退回到忙等方式 */
+	i2c->irq = platform_get_irq(pdev, 0);
+	if (i2c->irq >= 0) {
+		rc = devm_request_irq(&pdev->dev, i2c->irq, xxx_i2c_irq, 0,
+				      dev_name(&pdev->dev), i2c);
+		if (rc) {
+			dev_err(&pdev->dev, "cannot claim IRQ %d\n", i2c->irq);
+			return rc;
+		}
+	}
+
 	i2c->adap.owner = THIS_MODULE;
 	i2c->adap.algo = &xxx_i2c_algorithm;	/* 算法函数 */
+	i2c->adap.timeout = HZ;			/* i2c核心重试的总时限，adaptive_timeout=0时也是单次传输的超时 */
+	i2c->adap.retries = 2;			/* 仲裁失败等返回-EAGAIN时的重试次数 */
 	i2c->adap.dev.parent = &pdev->dev;
 	i2c->adap.dev.of_node = pdev->dev.of_node;
+	i2c->rinfo.recover_bus = i2c_generic_scl_recovery;
+	i2c->rinfo.get_scl = xxx_i2c_get_scl;
+	i2c->rinfo.set_scl = xxx_i2c_set_scl;
+	i2c->rinfo.get_sda = xxx_i2c_get_sda;
+	i2c->rinfo.set_sda = xxx_i2c_set_sda;
+	i2c->rinfo.prepare_recovery = xxx_i2c_prepare_recovery;
+	i2c->rinfo.unprepare_recovery = xxx_i2c_unprepare_recovery;
+	i2c->adap.bus_recovery_info = &i2c->rinfo;
+	i2c_set_adapdata(&i2c->adap, i2c);
+	platform_set_drvdata(pdev, i2c);
+
+	i2c->fifo_threshold = XXX_I2C_FIFO_THRESHOLD;
+	i2c->dma_threshold = XXX_I2C_DMA_THRESHOLD;
+	xxx_i2c_speed_init(i2c, &pdev->dev);
+	/* SCL被拉低超过它时报告卡死 */
+	i2c_adapter_xxx_set_stuck_timeout(xxx_i2c_stuck_us());
+	xxx_i2c_dma_init(i2c, &pdev->dev);
+	rc = devm_device_add_group(&pdev->dev, &xxx_i2c_attr_group);
+	if (rc) {
+		xxx_i2c_dma_free(i2c);
+		return rc;
+	}
+	rc = xxx_i2c_stats_init(i2c, &pdev->dev);
+	if (rc) {
+		xxx_i2c_dma_free(i2c);
+		return rc;
+	}
+
+	/* 要在i2c_add_adapter()之前注册，才能看到设备树和板级信息中的客户端 */
+	i2c->bus_nb.notifier_call = xxx_i2c_bus_notify;
+	rc = bus_register_notifier(&i2c_bus_type, &i2c->bus_nb);
+	if (rc) {
+		xxx_i2c_stats_exit(i2c);
+		xxx_i2c_dma_free(i2c);
+		return rc;
+	}
 
 	rc = i2c_add_adapter(adap);
 	...
@@ -175,6 +3075,12 @@ static int xxx_i2c_remove(struct platform_device *pdev)
 	...
 	xxx_adapter_hw_free(); /* 与xxx_adapter_hw_init()相反的操作 */
 	i2c_del_adapter(&i2c->adap);
+	bus_unregister_notifier(&i2c_bus_type, &i2c->bus_nb);
+	/* 异步提交的客户驱动此时应已全部解绑，队列为空 */
+	hrtimer_cancel(&i2c->timer);
+	cancel_work_sync(&i2c->timeout_work);
+	xxx_i2c_dma_free(i2c);
+	xxx_i2c_stats_exit(i2c);
 
 	return 0;
 }
@@ -194,4 +3100,31 @@ static struct platform_driver xxx_i2c_driver = {
 	.probe = xxx_i2c_probe,
 	.remove = xxx_i2c_remove,
 };
-module_platform_driver(xxx_i2c_driver);
+
+/* 适配器驱动和"xxx-slave"后端在同一个模块中 */
+static int __init xxx_i2c_init(void)
+{
+	int ret;
+
+	ret = platform_driver_register(&xxx_i2c_driver);
+	if (ret)
+		return ret;
+
+#if IS_ENABLED(CONFIG_I2C_SLAVE)
+	ret = i2c_add_driver(&xxx_slave_driver);
+	if (ret)
+		platform_driver_unregister(&xxx_i2c_driver);
+#endif
+
+	return ret;
+}
+module_init(xxx_i2c_init);
+
+static void __exit xxx_i2c_exit(void)
+{
+#if IS_ENABLED(CONFIG_I2C_SLAVE)
+	i2c_del_driver(&xxx_slave_driver);
+#endif
+	platform_driver_unregister(&xxx_i2c_driver);
+}
+module_exit(xxx_i2c_exit);
@@ -0,0 +1,870 @@
+/********************** 说明 ***************************
+ * 用户空间i2c总线模拟器，以LD_PRELOAD方式替换/dev/i2c-N的
+ * open()/ioctl()/read()/write()/close()，使i2c_app中的工具以及
+ * 以后的各种批量访问方式可以在没有i2c硬件的普通Linux机器上运行
+ * 和测量。
+ *
+ * 支持的i2c-dev语义：I2C_SLAVE/I2C_SLAVE_FORCE、I2C_TIMEOUT、
+ * I2C_RETRIES、I2C_TENBIT、I2C_PEC、I2C_FUNCS、I2C_RDWR、I2C_SMBUS
+ * （按内核的方式模拟成i2c消息），以及read()/write()（单次最多8192
+ * 字节，与i2c-dev一致）。
+ *
+ * 每条总线上挂接可插拔的设备模型：
+ * eeprom: 24Cxx风格EEPROM，带页缓冲和内部写周期，写周期内不应答
+ * regs:   寄存器文件型传感器，1字节寄存器指针，自动递增
+ *
+ * 时序模型按照线上实际传输的位数计时：START/重复START/STOP各1位，
+ * 地址和数据每字节8位+1位ACK，总线速率可选100kHz/400kHz/1MHz。
+ * 进程退出时打印每条总线的模拟总线时间以及进程的CPU时间。
+ *
+ * 编译：gcc -shared -fPIC -o libi2c_sim.so i2c_sim.c -ldl -lpthread
+ * 使用：LD_PRELOAD=./libi2c_sim.so ./i2c_dev_ioctl /dev/i2c-0 1d 0 16 batch
+ *
+ * 环境变量：
+ * I2C_SIM_SPEED    总线速率(Hz)，默认100000
+ * I2C_SIM_DEVICES  设备列表，格式 type@addr[/10][:size[:page[:twr_us]]]，逗号分隔，
+ *                  默认 "eeprom@50:65536:64:5000,regs@1d:256"
+ *                  加/10或者addr大于0x7f时是10位地址设备，只应答带
+ *                  I2C_M_TEN的消息，7位地址设备只应答不带的
+ * I2C_SIM_REALTIME 非0时按模拟的总线时间实际睡眠，使墙上时间接近真实硬件
+ * I2C_SIM_QUIET    非0时退出时不打印统计
+******************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define SIM_MAX_BUSES		16
+#define SIM_MAX_DEVS		8
+#define SIM_MAX_FDS		1024
+#define SIM_MSG_LEN_MAX		8192	/* i2c-dev中单条消息和read()/write()的上限 */
+#define SIM_DEVICES_DEFAULT	"eeprom@50:65536:64:5000,regs@1d:256"
+
+struct sim_dev;
+
+/* 设备模型接口，start()/write()返回0表示ACK */
+struct sim_dev_ops {
+	const char *name;
+	int (*init)(struct sim_dev *dev);
+	int (*start)(struct sim_dev *dev, int rd);
+	int (*write)(struct sim_dev *dev, unsigned char byte);
+	unsigned char (*read)(struct sim_dev *dev);
+	void (*stop)(struct sim_dev *dev);
+};
+
+struct sim_bus;
+
+struct sim_dev {
+	const struct sim_dev_ops *ops;
+	struct sim_bus *bus;
+	unsigned short addr;
+	unsigned short ten;		/* 10位地址设备为I2C_M_TEN */
+	unsigned char *mem;
+	unsigned long size;
+	unsigned int page;
+	unsigned long long twr_ns;
+	unsigned long long busy_until;	/* 内部写周期结束的总线时间 */
+	unsigned long ptr;		/* 内部地址指针 */
+	unsigned int addr_len;		/* 存储地址字节数 */
+	unsigned int addr_cnt;		/* 本次写事务已收到的地址字节数 */
+	unsigned char *latch;		/* EEPROM页缓冲 */
+	unsigned char *dirty;
+	unsigned long latch_base;
+	unsigned int latch_off;
+	int addressed;			/* 自上次STOP以来被寻址过 */
+};
+
+struct sim_stats {
+	unsigned long transfers;
+	unsigned long msgs;
+	unsigned long bytes_rd;
+	unsigned long bytes_wr;
+	unsigned long naks;
+};
+
+struct sim_bus {
+	pthread_mutex_t lock;		/* 相当于适配器的bus_lock */
+	int nr;
+	int used;
+	unsigned long long now_ns;	/* 模拟总线时间 */
+	struct sim_dev devs[SIM_MAX_DEVS];
+	int ndevs;
+	struct sim_stats stats;
+};
+
+struct sim_file {
+	struct sim_bus *bus;
+	unsigned short addr;
+	unsigned short flags;		/* I2C_M_TEN等，对应client->flags */
+};
+
+static int (*real_open)(const char *path, int flags, ...);
+static int (*real_close)(int fd);
+static ssize_t (*real_read)(int fd, void *buf, size_t count);
+static ssize_t (*real_write)(int fd, const void *buf, size_t count);
+static int (*real_ioctl)(int fd, unsigned long request, ...);
+
+static struct sim_bus sim_buses[SIM_MAX_BUSES];
+static struct sim_file *sim_files[SIM_MAX_FDS];
+static pthread_mutex_t sim_files_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long sim_speed = 100000;
+static unsigned long long sim_bit_ns;
+static int sim_realtime;
+static int sim_quiet;
+static const char *sim_devices;
+static struct timespec sim_cpu_start;
+
+/***** 24Cxx EEPROM *****/
+static int eeprom_init(struct sim_dev *dev)
+{
+	if (!dev->size)
+		dev->size = 65536;
+	if (!dev->page)
+		dev->page = 64;
+	dev->addr_len = dev->size > 2048 ? 2 : 1;
+	dev->mem = malloc(dev->size);
+	dev->latch = calloc(dev->page, 1);
+	dev->dirty = calloc(dev->page, 1);
+	if (!dev->mem || !dev->latch || !dev->dirty)
+		return -1;
+	memset(dev->mem, 0xff, dev->size);
+
+	return 0;
+}
+
+static int eeprom_start(struct sim_dev *dev, int rd)
+{
+	/* 内部写周期期间不应答自己的地址，主机据此做ACK轮询 */
+	if (dev->bus->now_ns < dev->busy_until)
+		return -1;
+	if (!rd)
+		dev->addr_cnt = 0;
+
+	return 0;
+}
+
+static int eeprom_write(struct sim_dev *dev, unsigned char byte)
+{
+	if (dev->addr_cnt < dev->addr_len) {
+		if (dev->addr_cnt == 0)
+			dev->ptr = 0;
+		dev->ptr = ((dev->ptr << 8) | byte) % dev->size;
+		if (++dev->addr_cnt == dev->addr_len) {
+			dev->latch_base = dev->ptr - dev->ptr % dev->page;
+			dev->latch_off = dev->ptr % dev->page;
+		}
+		return 0;
+	}
+
+	/* 数据先进入页缓冲，超出页尾时在页内回绕 */
+	dev->latch[dev->latch_off] = byte;
+	dev->dirty[dev->latch_off] = 1;
+	dev->latch_off = (dev->latch_off + 1) % dev->page;
+	dev->ptr = dev->latch_base + dev->latch_off;
+
+	return 0;
+}
+
+static unsigned char eeprom_read(struct sim_dev *dev)
+{
+	unsigned char byte = dev->mem[dev->ptr];
+
+	dev->ptr = (dev->ptr + 1) % dev->size;
+	return byte;
+}
+
+static void eeprom_stop(struct sim_dev *dev)
+{
+	unsigned int i;
+	int programmed = 0;
+
+	for (i = 0; i < dev->page; i++) {
+		if (!dev->dirty[i])
+			continue;
+		dev->mem[dev->latch_base + i] = dev->latch[i];
+		dev->dirty[i] = 0;
+		programmed = 1;
+	}
+	/* STOP之后开始内部写周期 */
+	if (programmed)
+		dev->busy_until = dev->bus->now_ns + dev->twr_ns;
+}
+
+static const struct sim_dev_ops eeprom_ops = {
+	.name	= "eeprom",
+	.init	= eeprom_init,
+	.start	= eeprom_start,
+	.write	= eeprom_write,
+	.read	= eeprom_read,
+	.stop	= eeprom_stop,
+};
+
+/***** 寄存器文件型传感器 *****/
+static int regs_init(struct sim_dev *dev)
+{
+	unsigned long i;
+
+	if (!dev->size || dev->size > 256)
+		dev->size = 256;
+	dev->mem = malloc(dev->size);
+	if (!dev->mem)
+		return -1;
+	for (i = 0; i < dev->size; i++)
+		dev->mem[i] = i;
+
+	return 0;
+}
+
+static int regs_start(struct sim_dev *dev, int rd)
+{
+	if (!rd)
+		dev->addr_cnt = 0;
+
+	return 0;
+}
+
+static int regs_write(struct sim_dev *dev, unsigned char byte)
+{
+	if (dev->addr_cnt == 0) {
+		dev->ptr = byte % dev->size;
+		dev->addr_cnt = 1;
+		return 0;
+	}
+	dev->mem[dev->ptr] = byte;
+	dev->ptr = (dev->ptr + 1) % dev->size;
+
+	return 0;
+}
+
+static unsigned char regs_read(struct sim_dev *dev)
+{
+	unsigned char byte = dev->mem[dev->ptr];
+
+	dev->ptr = (dev->ptr + 1) % dev->size;
+	return byte;
+}
+
+/* 寄存器指针跨传输保持，STOP时没有要做的 */
+static void regs_stop(struct sim_dev *dev)
+{
+	(void)dev;
+}
+
+static const struct sim_dev_ops regs_ops = {
+	.name	= "regs",
+	.init	= regs_init,
+	.start	= regs_start,
+	.write	= regs_write,
+	.read	= regs_read,
+	.stop	= regs_stop,
+};
+
+static const struct sim_dev_ops *sim_dev_types[] = {
+	&eeprom_ops,
+	&regs_ops,
+};
+
+/***** 总线 *****/
+static void sim_bus_setup(struct sim_bus *bus)
+{
+	const char *p = sim_devices;
+	char type[16];
+	unsigned int addr, page, twr_us;
+	unsigned long size;
+	struct sim_dev *dev;
+	unsigned int i;
+	int n, ten;
+
+	while (*p && bus->ndevs < SIM_MAX_DEVS) {
+		size = 0;
+		page = 0;
+		twr_us = 5000;
+		n = 0;
+		if (sscanf(p, "%15[a-z]@%x%n", type, &addr, &n) < 2)
+			break;
+		p += n;
+		ten = addr > 0x7f;
+		if (!strncmp(p, "/10", 3)) {
+			ten = 1;
+			p += 3;
+		}
+		if (sscanf(p, ":%lu%n", &size, &n) == 1) {
+			p += n;
+			if (sscanf(p, ":%u%n", &page, &n) == 1) {
+				p += n;
+				if (sscanf(p, ":%u%n", &twr_us, &n) == 1)
+					p += n;
+			}
+		}
+		if (*p == ',')
+			p++;
+
+		for (i = 0; i < sizeof(sim_dev_types) / sizeof(sim_dev_types[0]); i++)
+			if (!strcmp(type, sim_dev_types[i]->name))
+				break;
+		if (i == sizeof(sim_dev_types) / sizeof(sim_dev_types[0])) {
+			fprintf(stderr, "i2c_sim: unknown device type %s\n", type);
+			continue;
+		}
+		if (addr > 0x3ff) {
+			fprintf(stderr, "i2c_sim: invalid address %s@%x\n", type, addr);
+			continue;
+		}
+
+		dev = &bus->devs[bus->ndevs];
+		memset(dev, 0, sizeof(*dev));
+		dev->ops = sim_dev_types[i];
+		dev->bus = bus;
+		dev->addr = addr;
+		dev->ten = ten ? I2C_M_TEN : 0;
+		dev->size = size;
+		dev->page = page;
+		dev->twr_ns = twr_us * 1000ULL;
+		if (dev->ops->init(dev) < 0) {
+			fprintf(stderr, "i2c_sim: failed to init %s@%02x\n", type, addr);
+			continue;
+		}
+		bus->ndevs++;
+	}
+}
+
+/* 7位和10位地址是两个不同的地址空间，ten为消息的I2C_M_TEN */
+static struct sim_dev *sim_find_dev(struct sim_bus *bus, unsigned short addr,
+				    unsigned short ten)
+{
+	int i;
+
+	for (i = 0; i < bus->ndevs; i++)
+		if (bus->devs[i].addr == addr && bus->devs[i].ten == ten)
+			return &bus->devs[i];
+
+	return NULL;
+}
+
+static void sim_stop(struct sim_bus *bus)
+{
+	int i;
+
+	bus->now_ns += sim_bit_ns;
+	for (i = 0; i < bus->ndevs; i++) {
+		if (!bus->devs[i].addressed)
+			continue;
+		bus->devs[i].addressed = 0;
+		bus->devs[i].ops->stop(&bus->devs[i]);
+	}
+}
+
+/* 按线上的实际波形执行一组消息，调用者持有bus->lock */
+static int sim_xfer(struct sim_bus *bus, struct i2c_msg *msgs, int num)
+{
+	struct sim_dev *dev = NULL;
+	unsigned long long t0 = bus->now_ns;
+	struct timespec ts;
+	unsigned int j, len;
+	int rd;
+	int i;
+	int ret = num;
+
+	bus->stats.transfers++;
+	for (i = 0; i < num; i++) {
+		rd = msgs[i].flags & I2C_M_RD;
+		bus->stats.msgs++;
+
+		if (!(msgs[i].flags & I2C_M_NOSTART) || i == 0) {
+			/* START或重复START，然后是地址字节（10位地址多一个字节） */
+			bus->now_ns += sim_bit_ns;
+			bus->now_ns += 9 * sim_bit_ns;
+			if (msgs[i].flags & I2C_M_TEN)
+				bus->now_ns += 9 * sim_bit_ns;
+			dev = sim_find_dev(bus, msgs[i].addr, msgs[i].flags & I2C_M_TEN);
+			if (!dev || dev->ops->start(dev, rd)) {
+				bus->stats.naks++;
+				if (msgs[i].flags & I2C_M_IGNORE_NAK) {
+					dev = NULL;
+					goto next;
+				}
+				ret = -ENXIO;
+				break;
+			}
+			dev->addressed = 1;
+		}
+
+		len = msgs[i].len;
+		for (j = 0; j < len; j++) {
+			bus->now_ns += 9 * sim_bit_ns;
+			if (!dev) {
+				if (rd)
+					msgs[i].buf[j] = 0xff;
+				continue;
+			}
+			if (rd) {
+				msgs[i].buf[j] = dev->ops->read(dev);
+				/* SMBus块读，第一个字节是后续数据长度 */
+				if (j == 0 && (msgs[i].flags & I2C_M_RECV_LEN)) {
+					if (msgs[i].buf[0] > I2C_SMBUS_BLOCK_MAX) {
+						ret = -EPROTO;
+						goto out;
+					}
+					len = msgs[i].len = msgs[i].len + msgs[i].buf[0];
+				}
+				bus->stats.bytes_rd++;
+			} else {
+				bus->stats.bytes_wr++;
+				if (dev->ops->write(dev, msgs[i].buf[j])) {
+					bus->stats.naks++;
+					ret = -EIO;
+					goto out;
+				}
+			}
+		}
+next:
+		if ((msgs[i].flags & I2C_M_STOP) && i != num - 1)
+			sim_stop(bus);
+	}
+out:
+	sim_stop(bus);
+
+	if (sim_realtime) {
+		ts.tv_sec = (bus->now_ns - t0) / 1000000000ULL;
+		ts.tv_nsec = (bus->now_ns - t0) % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+
+	return ret;
+}
+
+static int sim_transfer(struct sim_bus *bus, struct i2c_msg *msgs, int num)
+{
+	int ret;
+
+	pthread_mutex_lock(&bus->lock);
+	ret = sim_xfer(bus, msgs, num);
+	pthread_mutex_unlock(&bus->lock);
+
+	return ret;
+}
+
+/***** i2c-dev接口 *****/
+static int sim_bus_nr(const char *path)
+{
+	char *end;
+	long nr;
+
+	if (strncmp(path, "/dev/i2c-", 9))
+		return -1;
+	nr = strtol(path + 9, &end, 10);
+	if (end == path + 9 || *end || nr < 0)
+		return -1;
+
+	return nr % SIM_MAX_BUSES;
+}
+
+static struct sim_file *sim_get_file(int fd)
+{
+	if (fd < 0 || fd >= SIM_MAX_FDS)
+		return NULL;
+
+	return sim_files[fd];
+}
+
+static int sim_open(const char *path, int nr)
+{
+	struct sim_bus *bus = &sim_buses[nr];
+	struct sim_file *file;
+	int fd;
+
+	/* 占用一个真实的fd号，保证与其他文件不冲突 */
+	fd = real_open("/dev/null", O_RDWR);
+	if (fd < 0)
+		return fd;
+	if (fd >= SIM_MAX_FDS) {
+		real_close(fd);
+		errno = EMFILE;
+		return -1;
+	}
+
+	file = calloc(1, sizeof(*file));
+	if (!file) {
+		real_close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	pthread_mutex_lock(&bus->lock);
+	if (!bus->used) {
+		bus->nr = strtol(path + 9, NULL, 10);
+		sim_bus_setup(bus);
+		bus->used = 1;
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	file->bus = bus;
+	pthread_mutex_lock(&sim_files_lock);
+	sim_files[fd] = file;
+	pthread_mutex_unlock(&sim_files_lock);
+
+	return fd;
+}
+
+static int sim_ioctl_rdwr(struct sim_file *file, struct i2c_rdwr_ioctl_data *rdwr)
+{
+	unsigned int i;
+	int ret;
+
+	if (!rdwr || !rdwr->msgs) {
+		errno = EFAULT;
+		return -1;
+	}
+	if (rdwr->nmsgs == 0 || rdwr->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < rdwr->nmsgs; i++) {
+		if (rdwr->msgs[i].len > SIM_MSG_LEN_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	ret = sim_transfer(file->bus, rdwr->msgs, rdwr->nmsgs);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+/* 与内核i2c_smbus_xfer_emulated()相同，把SMBus事务翻译成i2c消息 */
+static int sim_ioctl_smbus(struct sim_file *file, struct i2c_smbus_ioctl_data *args)
+{
+	union i2c_smbus_data *data = args->data;
+	unsigned char wbuf[I2C_SMBUS_BLOCK_MAX + 3];
+	unsigned char rbuf[I2C_SMBUS_BLOCK_MAX + 2];
+	struct i2c_msg msgs[2];
+	int rd = args->read_write == I2C_SMBUS_READ;
+	int num = rd ? 2 : 1;
+	int ret;
+
+	if (args->size != I2C_SMBUS_QUICK && !data) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	msgs[0].addr = file->addr;
+	msgs[0].flags = file->flags & I2C_M_TEN;
+	msgs[0].len = 1;
+	msgs[0].buf = wbuf;
+	msgs[1].addr = file->addr;
+	msgs[1].flags = (file->flags & I2C_M_TEN) | I2C_M_RD;
+	msgs[1].len = 0;
+	msgs[1].buf = rbuf;
+	wbuf[0] = args->command;
+
+	switch (args->size) {
+	case I2C_SMBUS_QUICK:
+		msgs[0].len = 0;
+		msgs[0].flags |= rd ? I2C_M_RD : 0;
+		num = 1;
+		break;
+	case I2C_SMBUS_BYTE:
+		if (rd) {
+			msgs[0].flags |= I2C_M_RD;
+			msgs[0].buf = rbuf;
+		}
+		num = 1;
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		if (rd) {
+			msgs[1].len = 1;
+		} else {
+			msgs[0].len = 2;
+			wbuf[1] = data->byte;
+		}
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		if (rd) {
+			msgs[1].len = 2;
+		} else {
+			msgs[0].len = 3;
+			wbuf[1] = data->word & 0xff;
+			wbuf[2] = data->word >> 8;
+		}
+		break;
+	case I2C_SMBUS_PROC_CALL:
+		num = 2;
+		rd = 1;
+		msgs[0].len = 3;
+		msgs[1].len = 2;
+		wbuf[1] = data->word & 0xff;
+		wbuf[2] = data->word >> 8;
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		if (rd) {
+			msgs[1].flags |= I2C_M_RECV_LEN;
+			msgs[1].len = 1;
+		} else {
+			if (data->block[0] > I2C_SMBUS_BLOCK_MAX) {
+				errno = EINVAL;
+				return -1;
+			}
+			msgs[0].len = data->block[0] + 2;
+			memcpy(&wbuf[1], data->block, data->block[0] + 1);
+		}
+		break;
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		if (data->block[0] > I2C_SMBUS_BLOCK_MAX) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (rd) {
+			msgs[1].len = data->block[0];
+		} else {
+			msgs[0].len = data->block[0] + 1;
+			memcpy(&wbuf[1], &data->block[1], data->block[0]);
+		}
+		break;
+	default:
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	ret = sim_transfer(file->bus, msgs, num);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	if (!rd)
+		return 0;
+
+	switch (args->size) {
+	case I2C_SMBUS_BYTE:
+		data->byte = rbuf[0];
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		data->byte = rbuf[0];
+		break;
+	case I2C_SMBUS_WORD_DATA:
+	case I2C_SMBUS_PROC_CALL:
+		data->word = rbuf[0] | (rbuf[1] << 8);
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		memcpy(data->block, rbuf, rbuf[0] + 1);
+		break;
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		memcpy(&data->block[1], rbuf, data->block[0]);
+		break;
+	}
+
+	return 0;
+}
+
+static int sim_ioctl(struct sim_file *file, unsigned long request, unsigned long arg)
+{
+	switch (request) {
+	case I2C_SLAVE:
+	case I2C_SLAVE_FORCE:
+		if (arg > ((file->flags & I2C_M_TEN) ? 0x3ff : 0x7f)) {
+			errno = EINVAL;
+			return -1;
+		}
+		file->addr = arg;
+		return 0;
+	case I2C_TENBIT:
+		if (arg)
+			file->flags |= I2C_M_TEN;
+		else
+			file->flags &= ~I2C_M_TEN;
+		return 0;
+	case I2C_PEC:
+	case I2C_TIMEOUT:
+	case I2C_RETRIES:
+		return 0;
+	case I2C_FUNCS:
+		*(unsigned long *)arg = I2C_FUNC_I2C | I2C_FUNC_10BIT_ADDR |
+			I2C_FUNC_PROTOCOL_MANGLING | I2C_FUNC_NOSTART |
+			I2C_FUNC_SMBUS_EMUL;
+		return 0;
+	case I2C_RDWR:
+		return sim_ioctl_rdwr(file, (struct i2c_rdwr_ioctl_data *)arg);
+	case I2C_SMBUS:
+		return sim_ioctl_smbus(file, (struct i2c_smbus_ioctl_data *)arg);
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+static ssize_t sim_rw(struct sim_file *file, void *buf, size_t count, int rd)
+{
+	struct i2c_msg msg;
+	int ret;
+
+	if (count > SIM_MSG_LEN_MAX)
+		count = SIM_MSG_LEN_MAX;
+
+	msg.addr = file->addr;
+	msg.flags = (file->flags & I2C_M_TEN) | (rd ? I2C_M_RD : 0);
+	msg.len = count;
+	msg.buf = buf;
+
+	ret = sim_transfer(file->bus, &msg, 1);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return count;
+}
+
+/***** 被替换的libc函数 *****/
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+	int nr;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	nr = sim_bus_nr(path);
+	if (nr >= 0)
+		return sim_open(path, nr);
+
+	return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return open(path, flags, mode);
+}
+
+int close(int fd)
+{
+	struct sim_file *file = sim_get_file(fd);
+
+	if (file) {
+		pthread_mutex_lock(&sim_files_lock);
+		sim_files[fd] = NULL;
+		pthread_mutex_unlock(&sim_files_lock);
+		free(file);
+	}
+
+	return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	struct sim_file *file = sim_get_file(fd);
+
+	if (file)
+		return sim_rw(file, buf, count, 1);
+
+	return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	struct sim_file *file = sim_get_file(fd);
+
+	if (file)
+		return sim_rw(file, (void *)buf, count, 0);
+
+	return real_write(fd, buf, count);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct sim_file *file = sim_get_file(fd);
+	unsigned long arg;
+	va_list ap;
+
+	va_start(ap, request);
+	arg = va_arg(ap, unsigned long);
+	va_end(ap);
+
+	if (file)
+		return sim_ioctl(file, request, arg);
+
+	return real_ioctl(fd, request, arg);
+}
+
+static __attribute__((constructor)) void sim_init(void)
+{
+	const char *s;
+	int i;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	s = getenv("I2C_SIM_SPEED");
+	if (s && strtoul(s, NULL, 0))
+		sim_speed = strtoul(s, NULL, 0);
+	sim_bit_ns = 1000000000ULL / sim_speed;
+	s = getenv("I2C_SIM_REALTIME");
+	sim_realtime = s && atoi(s);
+	s = getenv("I2C_SIM_QUIET");
+	sim_quiet = s && atoi(s);
+	sim_devices = getenv("I2C_SIM_DEVICES");
+	if (!sim_devices)
+		sim_devices = SIM_DEVICES_DEFAULT;
+
+	for (i = 0; i < SIM_MAX_BUSES; i++)
+		pthread_mutex_init(&sim_buses[i].lock, NULL);
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &sim_cpu_start);
+}
+
+static __attribute__((destructor)) void sim_exit(void)
+{
+	struct timespec cpu;
+	struct sim_bus *bus;
+	long cpu_us;
+	int i;
+
+	if (sim_quiet)
+		return;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	cpu_us = (cpu.tv_sec - sim_cpu_start.tv_sec) * 1000000L +
+		(cpu.tv_nsec - sim_cpu_start.tv_nsec) / 1000;
+
+	for (i = 0; i < SIM_MAX_BUSES; i++) {
+		bus = &sim_buses[i];
+		if (!bus->used)
+			continue;
+		fprintf(stderr, "i2c_sim: bus:%d speed:%luHz transfers:%lu msgs:%lu "
+			"rd:%lu wr:%lu naks:%lu bus_time:%lluus\n",
+			bus->nr, sim_speed, bus->stats.transfers, bus->stats.msgs,
+			bus->stats.bytes_rd, bus->stats.bytes_wr, bus->stats.naks,
+			bus->now_ns / 1000);
+	}
+	fprintf(stderr, "i2c_sim: cpu_time:%ldus\n", cpu_us);
+}
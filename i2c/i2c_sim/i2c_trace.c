@@ -0,0 +1,445 @@
+/********************** 说明 ***************************
+ * 用户空间的i2c传输捕获，以LD_PRELOAD方式截获/dev/i2c-N上的
+ * ioctl(I2C_RDWR/I2C_SMBUS)、read()和write()，把每次传输的每条
+ * i2c_msg按i2c_app/i2c_trace.h的格式记录下来，与内核中xxx_i2c的
+ * debugfs trace文件格式相同，可以用i2c_replay回放。
+ *
+ * 每个线程先写自己的缓冲区（相当于内核中的per-CPU缓冲区），满了或
+ * 线程/进程退出时才整块写入文件，记录时不加锁、不做系统调用。
+ * SMBus事务按i2c核心模拟时的消息序列记录。
+ *
+ * 编译：gcc -shared -fPIC -o libi2c_trace.so i2c_trace.c -ldl -lpthread
+ * 使用：LD_PRELOAD=./libi2c_trace.so ./i2c_sampler ...
+ *       与模拟器一起使用时放在前面：
+ *       LD_PRELOAD="./libi2c_trace.so ./libi2c_sim.so" ./i2c_bench ...
+ *
+ * 环境变量：
+ * I2C_TRACE_FILE     输出文件，默认i2c_trace.bin
+ * I2C_TRACE_PAYLOAD  每条消息最多记录的数据字节数，默认16
+******************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "../i2c_app/i2c_trace.h"
+
+#define TRACE_MAX_FDS		1024
+#define TRACE_BUF_SIZE		(256 * 1024)
+#define TRACE_MSG_MAX		8192	/* i2c-dev中单条消息的上限 */
+
+struct trace_fd {
+	int bus;		/* -1表示不是i2c设备 */
+	unsigned short addr;
+	unsigned short ten;	/* I2C_TENBIT设置后为I2C_M_TEN */
+};
+
+struct trace_buf {
+	struct trace_buf *next;
+	size_t len;
+	unsigned char data[TRACE_BUF_SIZE];
+};
+
+static int (*real_open)(const char *path, int flags, ...);
+static int (*real_close)(int fd);
+static ssize_t (*real_read)(int fd, void *buf, size_t count);
+static ssize_t (*real_write)(int fd, const void *buf, size_t count);
+static int (*real_ioctl)(int fd, unsigned long request, ...);
+
+static struct trace_fd trace_fds[TRACE_MAX_FDS];
+static int trace_out = -1;
+static unsigned int trace_payload = 16;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buf *trace_bufs;	/* 还在运行的线程的缓冲区，退出时逐个写出 */
+static pthread_key_t trace_key;
+static __thread struct trace_buf *trace_cur;
+
+static unsigned long long trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 调用者持有trace_lock */
+static void trace_flush_locked(struct trace_buf *tb)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < tb->len) {
+		n = real_write(trace_out, tb->data + off, tb->len - off);
+		if (n <= 0)
+			break;
+		off += n;
+	}
+	tb->len = 0;
+}
+
+/* 线程退出时写出并释放它的缓冲区，反复创建线程（如i2c_bench的每一轮）
+ * 不会让内存一直增长 */
+static void trace_thread_exit(void *arg)
+{
+	struct trace_buf *tb = arg, **p;
+
+	pthread_mutex_lock(&trace_lock);
+	trace_flush_locked(tb);
+	for (p = &trace_bufs; *p; p = &(*p)->next) {
+		if (*p == tb) {
+			*p = tb->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	trace_cur = NULL;
+	free(tb);
+}
+
+static struct trace_buf *trace_get_buf(void)
+{
+	struct trace_buf *tb = trace_cur;
+
+	if (tb)
+		return tb;
+
+	tb = calloc(1, sizeof(*tb));
+	if (!tb)
+		return NULL;
+
+	pthread_mutex_lock(&trace_lock);
+	tb->next = trace_bufs;
+	trace_bufs = tb;
+	pthread_mutex_unlock(&trace_lock);
+	pthread_setspecific(trace_key, tb);
+	trace_cur = tb;
+
+	return tb;
+}
+
+static void trace_record(struct trace_fd *tf, const struct i2c_msg *msgs,
+			 unsigned int n, int result, unsigned long long start)
+{
+	unsigned long long end = trace_now();
+	struct trace_buf *tb;
+	size_t size;
+
+	if (trace_out < 0 || n > 255)
+		return;
+
+	size = i2c_trace_size(msgs, n, trace_payload);
+	tb = trace_get_buf();
+	if (!tb || size > TRACE_BUF_SIZE)
+		return;
+
+	if (tb->len + size > TRACE_BUF_SIZE) {
+		pthread_mutex_lock(&trace_lock);
+		trace_flush_locked(tb);
+		pthread_mutex_unlock(&trace_lock);
+	}
+
+	tb->len += i2c_trace_encode(tb->data + tb->len, msgs, n, result, start,
+				    end - start, tf->bus, trace_payload);
+}
+
+static struct trace_fd *trace_get_fd(int fd)
+{
+	if (fd < 0 || fd >= TRACE_MAX_FDS || trace_fds[fd].bus < 0)
+		return NULL;
+
+	return &trace_fds[fd];
+}
+
+static int trace_bus_nr(const char *path)
+{
+	char *end;
+	long nr;
+
+	if (strncmp(path, "/dev/i2c-", 9))
+		return -1;
+	nr = strtol(path + 9, &end, 10);
+	if (end == path + 9 || *end || nr < 0)
+		return -1;
+
+	return nr;
+}
+
+/* 与i2c核心的i2c_smbus_xfer_emulated()相同的消息序列 */
+static void trace_smbus(struct trace_fd *tf, struct i2c_smbus_ioctl_data *args,
+			int ret, unsigned long long start)
+{
+	union i2c_smbus_data *data = args->data;
+	int rd = args->read_write == I2C_SMBUS_READ;
+	unsigned char w[I2C_SMBUS_BLOCK_MAX + 2];
+	unsigned char word[2];
+	struct i2c_msg msgs[2] = {
+		{ .addr = tf->addr, .flags = tf->ten, .len = 1, .buf = w },
+		{ .addr = tf->addr, .flags = tf->ten | I2C_M_RD },
+	};
+	unsigned int n = rd ? 2 : 1;
+
+	w[0] = args->command;
+	switch (args->size) {
+	case I2C_SMBUS_QUICK:
+		msgs[0].flags |= args->read_write ? I2C_M_RD : 0;
+		msgs[0].len = 0;
+		n = 1;
+		break;
+	case I2C_SMBUS_BYTE:
+		if (rd) {
+			msgs[0] = msgs[1];
+			msgs[0].len = 1;
+			msgs[0].buf = &data->byte;
+			n = 1;
+		}
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		if (rd) {
+			msgs[1].len = 1;
+			msgs[1].buf = &data->byte;
+		} else {
+			w[1] = data->byte;
+			msgs[0].len = 2;
+		}
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		if (rd) {
+			word[0] = data->word & 0xff;
+			word[1] = data->word >> 8;
+			msgs[1].len = 2;
+			msgs[1].buf = word;
+		} else {
+			w[1] = data->word & 0xff;
+			w[2] = data->word >> 8;
+			msgs[0].len = 3;
+		}
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		if (rd) {
+			msgs[1].flags |= I2C_M_RECV_LEN;
+			msgs[1].len = ret ? 1 : data->block[0] + 1;
+			msgs[1].buf = data->block;
+		} else {
+			if (data->block[0] > I2C_SMBUS_BLOCK_MAX)
+				return;
+			memcpy(&w[1], data->block, data->block[0] + 1);
+			msgs[0].len = data->block[0] + 2;
+		}
+		break;
+	case I2C_SMBUS_I2C_BLOCK_BROKEN:
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		if (data->block[0] > I2C_SMBUS_BLOCK_MAX)
+			return;
+		if (rd) {
+			msgs[1].len = data->block[0];
+			msgs[1].buf = &data->block[1];
+		} else {
+			memcpy(&w[1], &data->block[1], data->block[0]);
+			msgs[0].len = data->block[0] + 1;
+		}
+		break;
+	default:
+		/* 过程调用等不常用的协议不记录 */
+		return;
+	}
+
+	trace_record(tf, msgs, n, ret ? ret : (int)n, start);
+}
+
+/***** 被替换的libc函数 *****/
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+	int fd, nr;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	fd = real_open(path, flags, mode);
+	nr = trace_bus_nr(path);
+	if (fd >= 0 && fd < TRACE_MAX_FDS) {
+		trace_fds[fd].bus = nr;
+		trace_fds[fd].addr = 0;
+		trace_fds[fd].ten = 0;
+	}
+
+	return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return open(path, flags, mode);
+}
+
+int close(int fd)
+{
+	if (fd >= 0 && fd < TRACE_MAX_FDS)
+		trace_fds[fd].bus = -1;
+
+	return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	struct trace_fd *tf = trace_get_fd(fd);
+	unsigned long long start;
+	struct i2c_msg msg;
+	ssize_t ret;
+
+	if (!tf || count > TRACE_MSG_MAX)
+		return real_read(fd, buf, count);
+
+	start = trace_now();
+	ret = real_read(fd, buf, count);
+	msg.addr = tf->addr;
+	msg.flags = tf->ten | I2C_M_RD;
+	msg.len = count;
+	msg.buf = buf;
+	trace_record(tf, &msg, 1, ret < 0 ? -errno : 1, start);
+
+	return ret;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	struct trace_fd *tf = trace_get_fd(fd);
+	unsigned long long start;
+	struct i2c_msg msg;
+	ssize_t ret;
+
+	if (!tf || count > TRACE_MSG_MAX)
+		return real_write(fd, buf, count);
+
+	start = trace_now();
+	ret = real_write(fd, buf, count);
+	msg.addr = tf->addr;
+	msg.flags = tf->ten;
+	msg.len = count;
+	msg.buf = (unsigned char *)buf;
+	trace_record(tf, &msg, 1, ret < 0 ? -errno : 1, start);
+
+	return ret;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct trace_fd *tf = trace_get_fd(fd);
+	struct i2c_rdwr_ioctl_data *rdwr;
+	unsigned long long start;
+	unsigned long arg;
+	va_list ap;
+	int ret, err;
+
+	va_start(ap, request);
+	arg = va_arg(ap, unsigned long);
+	va_end(ap);
+
+	if (!tf)
+		return real_ioctl(fd, request, arg);
+
+	start = trace_now();
+	ret = real_ioctl(fd, request, arg);
+	err = errno;
+
+	switch (request) {
+	case I2C_SLAVE:
+	case I2C_SLAVE_FORCE:
+		if (ret == 0)
+			tf->addr = arg;
+		break;
+	case I2C_TENBIT:
+		if (ret == 0)
+			tf->ten = arg ? I2C_M_TEN : 0;
+		break;
+	case I2C_RDWR:
+		rdwr = (struct i2c_rdwr_ioctl_data *)arg;
+		trace_record(tf, rdwr->msgs, rdwr->nmsgs, ret < 0 ? -err : ret, start);
+		break;
+	case I2C_SMBUS:
+		trace_smbus(tf, (struct i2c_smbus_ioctl_data *)arg,
+			    ret < 0 ? -err : 0, start);
+		break;
+	}
+
+	errno = err;
+	return ret;
+}
+
+static __attribute__((constructor)) void trace_init(void)
+{
+	struct i2c_trace_file_hdr hdr = {
+		.magic = I2C_TRACE_MAGIC,
+		.version = I2C_TRACE_VERSION,
+	};
+	const char *s;
+	int i;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	for (i = 0; i < TRACE_MAX_FDS; i++)
+		trace_fds[i].bus = -1;
+
+	s = getenv("I2C_TRACE_PAYLOAD");
+	if (s)
+		trace_payload = strtoul(s, NULL, 0);
+	if (trace_payload > TRACE_MSG_MAX)
+		trace_payload = TRACE_MSG_MAX;
+	s = getenv("I2C_TRACE_FILE");
+	if (!s)
+		s = "i2c_trace.bin";
+
+	pthread_key_create(&trace_key, trace_thread_exit);
+	trace_out = real_open(s, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace_out < 0) {
+		fprintf(stderr, "i2c_trace: cannot open %s: %s\n", s, strerror(errno));
+		return;
+	}
+	hdr.payload = trace_payload;
+	real_write(trace_out, &hdr, sizeof(hdr));
+}
+
+static __attribute__((destructor)) void trace_exit(void)
+{
+	struct trace_buf *tb;
+
+	if (trace_out < 0)
+		return;
+
+	/* 还在运行的线程的缓冲区也一起写出 */
+	pthread_mutex_lock(&trace_lock);
+	for (tb = trace_bufs; tb; tb = tb->next)
+		trace_flush_locked(tb);
+	pthread_mutex_unlock(&trace_lock);
+	real_close(trace_out);
+	trace_out = -1;
+}